@@ -0,0 +1,238 @@
+#ifndef FIX_BINLOG_H_
+#define FIX_BINLOG_H_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opentrade/utility.h"
+
+namespace opentrade {
+
+// Binary FIX log, one segment file is a BinLogSegment followed by records,
+// each a BinLogRecord, then len bytes of message, padded to 8 bytes.
+// Timestamps are raw TSC, the segment header holds the calibration to
+// convert them to utc. A sync record, whose message is the int64_t utc in
+// nanoseconds at its TSC, is written at least every kSyncIntervalNs before
+// other records, the decoder re-anchors on it and re-derives the TSC rate
+// from the last two anchors, so the error of the short initial calibration
+// does not accumulate. See fixlog.cc for the decoder.
+struct BinLogSegment {
+  static constexpr char kMagic[8] = "FIXBLOG";
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t tsc0;
+  int64_t utc_ns0;
+  double ticks_per_ns;
+  char session[96];
+};
+
+struct BinLogRecord {
+  static constexpr char kIncoming = 'I';
+  static constexpr char kOutgoing = 'O';
+  static constexpr char kEvent = 'E';
+  static constexpr char kSync = 'S';
+  uint32_t len;
+  char dir;
+  char pad[3];
+  uint64_t tsc;
+};
+
+// Log of one session. Append is called by one thread at a time (QuickFIX
+// logs under the session state lock) and copies the record into an SPSC
+// ring, a single flusher thread shared by all logs writes the ring to
+// segment files. The session thread never formats, allocates nor does IO,
+// it only waits if the flusher falls a whole ring behind.
+class BinLog {
+ public:
+  static constexpr size_t kRingSize = 1 << 24;
+  static constexpr size_t kSegmentSize = 1 << 28;
+  static constexpr int64_t kSyncIntervalNs = 1000000000;
+
+  BinLog(const std::string& path, const std::string& session)
+      : path_(path), session_(session), ring_(new char[kRingSize]) {
+    auto& reg = GetRegistry();
+    std::lock_guard<std::mutex> lock(reg.m);
+    reg.logs.push_back(this);
+    if (!reg.started) {
+      reg.started = true;
+      std::thread(&FlushAll).detach();
+    }
+  }
+
+  ~BinLog() {
+    auto& reg = GetRegistry();
+    std::lock_guard<std::mutex> lock(reg.m);
+    reg.logs.erase(std::find(reg.logs.begin(), reg.logs.end(), this));
+    Flush();
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  void Append(char dir, const char* data, size_t len) {
+    BinLogRecord rec{static_cast<uint32_t>(len), dir, {}, Rdtsc()};
+    auto need = sizeof(rec) + ((len + 7) & ~7ul);
+    if (need > kRingSize) return;
+    auto head = head_.load(std::memory_order_relaxed);
+    while (head + need - tail_.load(std::memory_order_acquire) > kRingSize)
+      std::this_thread::yield();
+    CopyIn(head, &rec, sizeof(rec));
+    CopyIn(head + sizeof(rec), data, len);
+    head_.store(head + need, std::memory_order_release);
+  }
+
+  // start a new segment file at the next flush
+  void Roll() { roll_ = true; }
+
+ private:
+  struct Registry {
+    std::mutex m;
+    std::vector<BinLog*> logs;
+    bool started = false;
+  };
+
+  // never destroyed, the flusher runs until exit
+  static Registry& GetRegistry() {
+    static auto kRegistry = new Registry;
+    return *kRegistry;
+  }
+
+  static void FlushAll() {
+    auto& reg = GetRegistry();
+    while (true) {
+      auto n = 0;
+      {
+        std::lock_guard<std::mutex> lock(reg.m);
+        for (auto log : reg.logs) n += log->Flush();
+      }
+      if (!n) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  static void Calibrate(uint64_t* tsc0, int64_t* utc_ns0,
+                        double* ticks_per_ns) {
+    static const auto kTicksPerNano = []() {
+      auto t0 = Rdtsc();
+      auto n0 = NowInNano();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      return static_cast<double>(Rdtsc() - t0) / (NowInNano() - n0);
+    }();
+    GetAnchor(tsc0, utc_ns0);
+    *ticks_per_ns = kTicksPerNano;
+  }
+
+  // TSC and utc in nanoseconds at the same moment, the TSC being the
+  // midpoint of the two reads around clock_gettime
+  static void GetAnchor(uint64_t* tsc, int64_t* utc_ns) {
+    struct timespec now;
+    auto t0 = Rdtsc();
+    clock_gettime(CLOCK_REALTIME, &now);
+    auto t1 = Rdtsc();
+    *tsc = t0 + (t1 - t0) / 2;
+    *utc_ns = now.tv_sec * 1000000000l + now.tv_nsec;
+  }
+
+  void WriteSync() {
+    int64_t utc_ns;
+    BinLogRecord rec{sizeof(utc_ns), BinLogRecord::kSync, {}, 0};
+    GetAnchor(&rec.tsc, &utc_ns);
+    Write(&rec, sizeof(rec));
+    Write(&utc_ns, sizeof(utc_ns));
+    written_ += sizeof(rec) + sizeof(utc_ns);
+    last_sync_ = utc_ns;
+  }
+
+  void CopyIn(uint64_t pos, const void* data, size_t len) {
+    auto off = pos & (kRingSize - 1);
+    auto n = std::min(len, kRingSize - off);
+    std::memcpy(ring_.get() + off, data, n);
+    std::memcpy(ring_.get(), static_cast<const char*>(data) + n, len - n);
+  }
+
+  bool Write(const void* data, size_t len) {
+    while (len) {
+      auto n = ::write(fd_, data, len);
+      if (n <= 0) return false;
+      data = static_cast<const char*>(data) + n;
+      len -= n;
+    }
+    return true;
+  }
+
+  // <session>.<utc time>.<pid>.<n>.binlog, never overwriting an existing
+  // file, e.g. of a process restarted within the same second
+  void Open() {
+    if (fd_ >= 0) ::close(fd_);
+    mkdir(path_.c_str(), 0755);
+    char ts[32];
+    auto t = time(nullptr);
+    struct tm tm_info;
+    gmtime_r(&t, &tm_info);
+    strftime(ts, sizeof(ts), "%Y%m%d-%H%M%S", &tm_info);
+    auto prefix = path_ + "/" + session_ + "." + ts + "." +
+                  std::to_string(getpid()) + ".";
+    std::string fn;
+    do {
+      fn = prefix + std::to_string(segment_count_++) + ".binlog";
+      fd_ = ::open(fn.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (fd_ < 0 && errno == EEXIST);
+    if (fd_ < 0) {
+      std::cerr << "Failed to open " << fn << ": " << strerror(errno)
+                << std::endl;
+      return;
+    }
+    BinLogSegment seg{};
+    std::memcpy(seg.magic, BinLogSegment::kMagic, sizeof(seg.magic));
+    seg.version = 2;
+    Calibrate(&seg.tsc0, &seg.utc_ns0, &seg.ticks_per_ns);
+    strncpy(seg.session, session_.c_str(), sizeof(seg.session) - 1);
+    Write(&seg, sizeof(seg));
+    written_ = sizeof(seg);
+    last_sync_ = seg.utc_ns0;
+  }
+
+  // consumer side, writes everything appended so far, only whole records
+  bool Flush() {
+    auto head = head_.load(std::memory_order_acquire);
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (head == tail) return false;
+    if (fd_ < 0 || roll_.exchange(false) || written_ >= kSegmentSize) Open();
+    auto len = head - tail;
+    auto off = tail & (kRingSize - 1);
+    auto n = std::min<uint64_t>(len, kRingSize - off);
+    if (fd_ >= 0) {
+      if (NowUtcInMicro() * 1000 - last_sync_ >= kSyncIntervalNs) WriteSync();
+      Write(ring_.get() + off, n);
+      Write(ring_.get(), len - n);
+      written_ += len;
+    }
+    tail_.store(head, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  const std::string path_;
+  const std::string session_;
+  std::unique_ptr<char[]> ring_;
+  alignas(64) std::atomic<uint64_t> head_ = 0;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+  std::atomic<bool> roll_ = false;
+  int fd_ = -1;
+  uint64_t written_ = 0;
+  int64_t last_sync_ = 0;  // utc in nanoseconds
+  int segment_count_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // FIX_BINLOG_H_
@@ -0,0 +1,264 @@
+#ifndef FIX_ENCODER_H_
+#define FIX_ENCODER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <utility>
+
+namespace opentrade {
+
+// Run of pre-rendered "tag=value<SOH>" fields with its byte sum, so that tags
+// which do not change from order to order (e.g. symbol and destination of a
+// security) are formatted once and then copied into each message.
+struct FixSegment {
+  std::string bytes;
+  uint32_t sum = 0;
+
+  void Add(int tag, const std::string& value) {
+    auto n = bytes.size();
+    bytes += std::to_string(tag);
+    bytes += '=';
+    bytes += value;
+    bytes += '\x01';
+    for (auto i = n; i < bytes.size(); ++i) sum += (uint8_t)bytes[i];
+  }
+  void Add(int tag, char value) { Add(tag, std::string(1, value)); }
+};
+
+// Writes FIX messages straight into a fixed buffer. The body is encoded
+// first, summing bytes as they are written; Finish then renders the header
+// right in front of it, because BodyLength and MsgSeqNum are only known at
+// that point, and appends CheckSum. No FIX::Message, field map or heap
+// allocation is involved. A body longer than kBufferSize is not written, it
+// sets overflow() and Finish returns nullptr.
+class FixEncoder {
+ public:
+  static constexpr size_t kHeadRoom = 256;
+  static constexpr size_t kBufferSize = 4096;
+  // header bytes besides BeginString and CompIDs at most, i.e. BodyLength,
+  // MsgType, MsgSeqNum and SendingTime with their tags
+  static constexpr size_t kMaxMsgType = 8;
+  static constexpr size_t kMaxFixedHeader = 23 + 4 + kMaxMsgType + 24 + 25;
+
+  // false if the header does not fit in kHeadRoom
+  bool Init(const std::string& begin_string, const std::string& sender,
+            const std::string& target) {
+    begin_.bytes = "8=" + begin_string + '\x01';
+    begin_.sum = 0;
+    for (auto c : begin_.bytes) begin_.sum += (uint8_t)c;
+    comp_ids_ = FixSegment{};
+    comp_ids_.Add(49, sender);
+    comp_ids_.Add(56, target);
+    return begin_.bytes.size() + comp_ids_.bytes.size() + kMaxFixedHeader <=
+           kHeadRoom;
+  }
+
+  void Begin(const char* msg_type) {
+    msg_type_ = msg_type;
+    p_ = body_ = buf_ + kHeadRoom;
+    end_ = body_ + kBufferSize;
+    sum_ = 0;
+    overflow_ = false;
+  }
+
+  // the body did not fit, nothing more is written
+  bool overflow() const { return overflow_; }
+
+  void Add(const FixSegment& seg) {
+    if (seg.bytes.size() > static_cast<size_t>(end_ - p_)) {
+      overflow_ = true;
+      return;
+    }
+    std::memcpy(p_, seg.bytes.data(), seg.bytes.size());
+    p_ += seg.bytes.size();
+    sum_ += seg.sum;
+  }
+
+  void Add(int tag, char value) {
+    PutTag(tag);
+    Put(value);
+    Put('\x01');
+  }
+
+  void Add(int tag, int64_t value) {
+    PutTag(tag);
+    PutInt(value);
+    Put('\x01');
+  }
+
+  // up to 9 decimals, trailing zeros trimmed as QuickFIX does
+  void Add(int tag, double value) {
+    PutTag(tag);
+    if (value < 0) {
+      Put('-');
+      value = -value;
+    }
+    auto ip = static_cast<uint64_t>(value);
+    auto frac = static_cast<uint64_t>((value - ip) * 1e9 + 0.5);
+    if (frac >= 1000000000ul) {
+      ip++;
+      frac -= 1000000000ul;
+    }
+    PutInt(ip);
+    if (frac) {
+      char digits[9];
+      auto n = 9;
+      while (frac % 10 == 0) {
+        frac /= 10;
+        n--;
+      }
+      for (auto i = n - 1; i >= 0; --i, frac /= 10)
+        digits[i] = '0' + frac % 10;
+      Put('.');
+      for (auto i = 0; i < n; ++i) Put(digits[i]);
+    }
+    Put('\x01');
+  }
+
+  void Add(int tag, const char* value, size_t n) {
+    PutTag(tag);
+    for (auto i = 0u; i < n; ++i) Put(value[i]);
+    Put('\x01');
+  }
+
+  // UTCTimestamp with milliseconds
+  void AddTime(int tag, int64_t utc_micro) {
+    PutTag(tag);
+    PutTime(utc_micro);
+    Put('\x01');
+  }
+
+  // renders the standard header with seq and sending time in front of the
+  // body and appends the trailer, returns the whole message, or nullptr if
+  // it does not fit
+  std::pair<const char*, size_t> Finish(int64_t seq, int64_t utc_micro) {
+    if (overflow_ || std::strlen(msg_type_) > kMaxMsgType) return {};
+    auto body = p_;
+    auto body_sum = sum_;
+    // header fields after BodyLength, in scratch space behind the body, which
+    // has kHeadRoom spare for them
+    end_ = buf_ + sizeof(buf_);
+    sum_ = 0;
+    PutTag(35);
+    for (auto c = msg_type_; *c; ++c) Put(*c);
+    Put('\x01');
+    Add(comp_ids_);
+    Add(34, seq);
+    AddTime(52, utc_micro);
+    auto tail_len = p_ - body;
+    auto tail_sum = sum_;
+    auto len = (body - body_) + tail_len;
+    char len_buf[32];
+    auto len_end = len_buf + sizeof(len_buf);
+    auto q = len_end;
+    *--q = '\x01';
+    do {
+      *--q = '0' + len % 10;
+      len /= 10;
+    } while (len);
+    *--q = '=';
+    *--q = '9';
+    uint32_t len_sum = 0;
+    for (auto c = q; c < len_end; ++c) len_sum += (uint8_t)*c;
+    auto head_len = tail_len + (len_end - q) + begin_.bytes.size();
+    if (overflow_ || head_len > kHeadRoom) return {};
+    auto start = body_ - head_len;
+    auto w = start;
+    std::memcpy(w, begin_.bytes.data(), begin_.bytes.size());
+    w += begin_.bytes.size();
+    std::memcpy(w, q, len_end - q);
+    w += len_end - q;
+    std::memmove(w, body, tail_len);
+    // body stays where it is, header now ends exactly at body_
+    p_ = body;
+    auto sum = begin_.sum + len_sum + tail_sum + body_sum;
+    Put('1');
+    Put('0');
+    Put('=');
+    sum %= 256;
+    Put('0' + sum / 100);
+    Put('0' + sum / 10 % 10);
+    Put('0' + sum % 10);
+    Put('\x01');
+    if (overflow_) return {};
+    return {start, static_cast<size_t>(p_ - start)};
+  }
+
+ private:
+  void Put(char c) {
+    if (p_ == end_) {
+      overflow_ = true;
+      return;
+    }
+    *p_++ = c;
+    sum_ += (uint8_t)c;
+  }
+
+  void PutInt(int64_t v) {
+    if (v < 0) {
+      Put('-');
+      v = -v;
+    }
+    char digits[20];
+    auto n = 0;
+    do {
+      digits[n++] = '0' + v % 10;
+      v /= 10;
+    } while (v);
+    while (n) Put(digits[--n]);
+  }
+
+  void PutTag(int tag) {
+    PutInt(tag);
+    Put('=');
+  }
+
+  void Put2(int v) {
+    Put('0' + v / 10);
+    Put('0' + v % 10);
+  }
+
+  void PutTime(int64_t utc_micro) {
+    auto secs = utc_micro / 1000000;
+    if (secs != time_secs_) {
+      time_secs_ = secs;
+      time_t t = secs;
+      gmtime_r(&t, &time_tm_);
+    }
+    auto& tm = time_tm_;
+    auto year = tm.tm_year + 1900;
+    Put2(year / 100);
+    Put2(year % 100);
+    Put2(tm.tm_mon + 1);
+    Put2(tm.tm_mday);
+    Put('-');
+    Put2(tm.tm_hour);
+    Put(':');
+    Put2(tm.tm_min);
+    Put(':');
+    Put2(tm.tm_sec);
+    Put('.');
+    auto ms = utc_micro / 1000 % 1000;
+    Put('0' + ms / 100);
+    Put2(ms % 100);
+  }
+
+ private:
+  char buf_[kHeadRoom + kBufferSize + kHeadRoom];
+  char* body_ = buf_ + kHeadRoom;
+  char* p_ = body_;
+  char* end_ = body_ + kBufferSize;
+  uint32_t sum_ = 0;
+  bool overflow_ = false;
+  const char* msg_type_ = "";
+  FixSegment begin_;
+  FixSegment comp_ids_;
+  int64_t time_secs_ = -1;
+  struct tm time_tm_ {};
+};
+
+}  // namespace opentrade
+
+#endif  // FIX_ENCODER_H_
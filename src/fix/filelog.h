@@ -7,95 +7,58 @@
 #undef private
 #undef throw
 
-#include "opentrade/task_pool.h"
+#include "binlog.h"
 
 namespace FIX {
 
-class AsyncFileLog : public FileLog {
+// Session log in binary segments under FileLogPath, decode with fixlog.
+class BinaryFileLog : public Log {
  public:
-  explicit AsyncFileLog(const std::string& path) : FileLog(path) {}
-  AsyncFileLog(const std::string& path, const SessionID& sessionID)
-      : FileLog(path, sessionID) {}
-  AsyncFileLog(const std::string& path, const std::string& backupPath,
-               const SessionID& sessionID)
-      : FileLog(path, backupPath, sessionID) {}
+  BinaryFileLog(const std::string& path, const std::string& prefix)
+      : log_(path, prefix) {}
 
-  void appendTime(const std::string& value, std::string& newvalue) {
-    struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
-    char buf[64];
-    int n = snprintf(buf, sizeof(buf), "0=%ld.%ld\1", t.tv_sec, t.tv_nsec);
-    if (n < 0) n = 0;
-    newvalue.reserve(value.length() + n + 1);
-    newvalue.append(value);
-    if (n > 0) newvalue.append(buf);
-  }
+  // raw message the session on this thread is processing, it stays valid
+  // until the session returns from handing it to the application
+  static inline thread_local const std::string* incoming = nullptr;
 
   void onIncoming(const std::string& value) override {
-    std::string newvalue;
-    appendTime(value, newvalue);
-    pool_.AddTask([=]() { this->FileLog::onIncoming(newvalue); });
+    incoming = &value;
+    log_.Append(opentrade::BinLogRecord::kIncoming, value.data(),
+                value.size());
   }
   void onOutgoing(const std::string& value) override {
-    std::string newvalue;
-    appendTime(value, newvalue);
-    pool_.AddTask([=]() { this->FileLog::onOutgoing(newvalue); });
+    log_.Append(opentrade::BinLogRecord::kOutgoing, value.data(),
+                value.size());
   }
   void onEvent(const std::string& value) override {
-    pool_.AddTask([=]() { this->FileLog::onEvent(value); });
-  }
-  void clear() override {
-    pool_.AddTask([=]() { this->FileLog::clear(); });
-  }
-  void backup() override {
-    pool_.AddTask([=]() { this->FileLog::backup(); });
+    log_.Append(opentrade::BinLogRecord::kEvent, value.data(), value.size());
   }
+  // earlier segments are kept, both only start a new one
+  void clear() override { log_.Roll(); }
+  void backup() override { log_.Roll(); }
 
  private:
-  opentrade::TaskPool pool_;
+  opentrade::BinLog log_;
 };
 
-class AsyncFileLogFactory : public FileLogFactory {
+class BinaryFileLogFactory : public FileLogFactory {
  public:
-  explicit AsyncFileLogFactory(const SessionSettings& settings)
+  explicit BinaryFileLogFactory(const SessionSettings& settings)
       : FileLogFactory(settings) {}
-  explicit AsyncFileLogFactory(const std::string& path)
+  explicit BinaryFileLogFactory(const std::string& path)
       : FileLogFactory(path) {}
-  AsyncFileLogFactory(const std::string& path, const std::string& backupPath)
-      : FileLogFactory(path, backupPath) {}
-
- public:
-  Log* create() {
-    m_globalLogCount++;
-    if (m_globalLogCount > 1) return m_globalLog;
-
-    try {
-      if (m_path.size()) return new AsyncFileLog(m_path);
-      std::string path;
-      std::string backupPath;
-
-      Dictionary settings = m_settings.get();
-      path = settings.getString(FILE_LOG_PATH);
-      backupPath = path;
-      if (settings.has(FILE_LOG_BACKUP_PATH))
-        backupPath = settings.getString(FILE_LOG_BACKUP_PATH);
-
-      return m_globalLog = new AsyncFileLog(path);
-    } catch (ConfigError&) {
-      m_globalLogCount--;
-      throw;
-    }
-  }
-
-  Log* create(const SessionID& s) {
-    if (m_path.size() && m_backupPath.size())
-      return new AsyncFileLog(m_path, m_backupPath, s);
-    if (m_path.size()) return new AsyncFileLog(m_path, s);
 
-    std::string path;
+  // the global log shared by sessions stays FileLog's
+  using FileLogFactory::create;
+  Log* create(const SessionID& s) override {
+    auto prefix = s.getBeginString().getString() + "-" +
+                  s.getSenderCompID().getString() + "-" +
+                  s.getTargetCompID().getString();
+    if (!s.getSessionQualifier().empty())
+      prefix += "-" + s.getSessionQualifier();
+    if (m_path.size()) return new BinaryFileLog(m_path, prefix);
     Dictionary settings = m_settings.get(s);
-    path = settings.getString(FILE_LOG_PATH);
-    return new AsyncFileLog(path, s);
+    return new BinaryFileLog(settings.getString(FILE_LOG_PATH), prefix);
   }
 };
 
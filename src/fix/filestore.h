@@ -6,86 +6,216 @@
 #include <quickfix/FileStore.h>
 #undef private
 #undef throw
-#include <mutex>
-
-#include "opentrade/task_pool.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 
 namespace FIX {
 
-class AsyncFileStore : public FileStore {
+// Message store in one pre-allocated memory mapped file:
+// header (sequence numbers, creation time, write position), an index of
+// kSlots entries addressed by seq % kSlots, and a ring of message bytes.
+// Appends reserve ring space with a CAS on the write position and publish
+// the index entry last, no lock is taken and nothing is posted to another
+// thread. A resend lookup is one index probe per message, entries whose
+// bytes have been overwritten by the ring are reported as missing, so that
+// the session gap fills them. Everything lives in the page cache, so a
+// process crash loses nothing; the OS flushes it to disk on its own.
+// A new ring file takes the sequence numbers and creation time of the
+// session's QuickFIX FileStore files if any, so that switching stores does
+// not reset the session; their messages are not imported and gap filled if
+// asked for. Changing the ring size drops the stored messages only.
+class MmapFileStore : public MessageStore {
  public:
-  AsyncFileStore(std::string path, const SessionID& s) : FileStore(path, s) {}
+  static constexpr uint64_t kMagic = 0x474e495258494621ull;  // "!FIXRING"
+  static constexpr uint64_t kSlots = 1 << 20;
+  static constexpr uint64_t kDefaultRingSize = 1ull << 28;
+
+  MmapFileStore(const std::string& path, const SessionID& s,
+                uint64_t ring_size = kDefaultRingSize) {
+    // as FileStore names its files
+    auto prefix = path + "/" + s.getBeginString().getString() + "-" +
+                  s.getSenderCompID().getString() + "-" +
+                  s.getTargetCompID().getString();
+    if (!s.getSessionQualifier().empty())
+      prefix += "-" + s.getSessionQualifier();
+    auto fn = prefix + ".ring";
+    size_ = sizeof(Header) + kSlots * sizeof(Slot) + ring_size;
+    mkdir(path.c_str(), 0755);
+    fd_ = ::open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) throw ConfigError("Could not open store file: " + fn);
+    struct stat st;
+    if (fstat(fd_, &st)) throw ConfigError("Could not stat store file: " + fn);
+    // the header of an existing file is read before it is resized
+    Header old{};
+    if (static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+        pread(fd_, &old, sizeof(old), 0) != sizeof(old))
+      old.magic = 0;
+    if (static_cast<uint64_t>(st.st_size) != size_ && ftruncate(fd_, size_))
+      throw ConfigError("Could not allocate store file: " + fn);
+    auto p =
+        mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) throw ConfigError("Could not map store file: " + fn);
+    header_ = reinterpret_cast<Header*>(p);
+    slots_ = reinterpret_cast<Slot*>(header_ + 1);
+    ring_ = reinterpret_cast<char*>(slots_ + kSlots);
+    if (old.magic == kMagic && old.ring_size == ring_size) return;
+    header_->ring_size = ring_size;
+    reset();
+    if (old.magic == kMagic) {
+      // ring size changed, the session goes on
+      header_->next_sender = old.next_sender.load();
+      header_->next_target = old.next_target.load();
+      header_->creation_time = old.creation_time;
+    } else {
+      Import(prefix);
+    }
+    header_->magic = kMagic;
+  }
+
+  ~MmapFileStore() {
+    munmap(header_, size_);
+    ::close(fd_);
+  }
 
   bool set(int seq, const std::string& msg) override {
-    pool_.AddTask([=]() { set_(seq, msg); });
+    auto len = msg.size();
+    auto ring_size = header_->ring_size;
+    if (len > ring_size) return false;
+    uint64_t pos = header_->write_pos.load(std::memory_order_relaxed);
+    uint64_t start;
+    do {
+      start = pos;
+      // a message never straddles the end of the ring
+      if (start % ring_size + len > ring_size)
+        start += ring_size - start % ring_size;
+    } while (!header_->write_pos.compare_exchange_weak(
+        pos, start + len, std::memory_order_acq_rel));
+    std::memcpy(ring_ + start % ring_size, msg.data(), len);
+    auto& slot = slots_[seq % kSlots];
+    slot.seq.store(0, std::memory_order_relaxed);
+    slot.offset = start;
+    slot.len = len;
+    slot.seq.store(seq, std::memory_order_release);
     return true;
   }
+
   void get(int begin, int end,
            std::vector<std::string>& result) const override {
-    std::scoped_lock<std::mutex> lock(m_);
-    return FileStore::get(begin, end, result);
+    result.clear();
+    auto ring_size = header_->ring_size;
+    for (auto seq = begin; seq <= end; ++seq) {
+      auto& slot = slots_[seq % kSlots];
+      if (slot.seq.load(std::memory_order_acquire) != seq) continue;
+      auto offset = slot.offset;
+      auto len = slot.len;
+      std::string msg(ring_ + offset % ring_size, len);
+      // dropped if overwritten by the ring or the slot reused meanwhile
+      if (header_->write_pos.load(std::memory_order_acquire) - offset >
+              ring_size ||
+          slot.seq.load(std::memory_order_acquire) != seq)
+        continue;
+      result.push_back(std::move(msg));
+    }
   }
 
+  int getNextSenderMsgSeqNum() const override { return header_->next_sender; }
+  int getNextTargetMsgSeqNum() const override { return header_->next_target; }
   void setNextSenderMsgSeqNum(int value) override {
-    m_cache.setNextSenderMsgSeqNum(value);
-    pool_.AddTask([this]() { setSeqNum_(); });
+    header_->next_sender = value;
   }
   void setNextTargetMsgSeqNum(int value) override {
-    m_cache.setNextTargetMsgSeqNum(value);
-    pool_.AddTask([this]() { setSeqNum_(); });
+    header_->next_target = value;
   }
-  void incrNextSenderMsgSeqNum() override {
-    m_cache.incrNextSenderMsgSeqNum();
-    pool_.AddTask([this]() { setSeqNum_(); });
-  }
-  void incrNextTargetMsgSeqNum() override {
-    m_cache.incrNextTargetMsgSeqNum();
-    pool_.AddTask([this]() { setSeqNum_(); });
+  void incrNextSenderMsgSeqNum() override { header_->next_sender++; }
+  void incrNextTargetMsgSeqNum() override { header_->next_target++; }
+
+  UtcTimeStamp getCreationTime() const override {
+    return UtcTimeStamp(static_cast<time_t>(header_->creation_time));
   }
 
   void reset() override {
-    std::scoped_lock<std::mutex> lock(m_);
-    FileStore::reset();
-  }
-  void refresh() override {
-    std::scoped_lock<std::mutex> lock(m_);
-    FileStore::refresh();
+    std::memset(static_cast<void*>(slots_), 0, kSlots * sizeof(Slot));
+    header_->write_pos = 0;
+    header_->next_sender = 1;
+    header_->next_target = 1;
+    header_->creation_time = UtcTimeStamp().getTimeT();
   }
 
+  // the mapping is the store itself, nothing to reload
+  void refresh() override {}
+
  private:
-  void set_(int seq, const std::string& msg) {
-    std::scoped_lock<std::mutex> lock(m_);
-    try {
-      FileStore::set(seq, msg);
-    } catch (const IOException& e) {
-      std::cerr << e.what() << std::endl;
+  // sequence numbers and creation time of QuickFIX FileStore, whose
+  // <prefix>.seqnums is "<next sender> : <next target>" and <prefix>.session
+  // the creation time as UTCTimestamp
+  void Import(const std::string& prefix) {
+    auto f = fopen((prefix + ".seqnums").c_str(), "r");
+    if (!f) return;
+    int sender, target;
+    if (fscanf(f, "%d : %d", &sender, &target) == 2) {
+      header_->next_sender = sender;
+      header_->next_target = target;
     }
-  }
-
-  void setSeqNum_() {
-    std::scoped_lock<std::mutex> lock(m_);
-    FileStore::setSeqNum();
+    fclose(f);
+    f = fopen((prefix + ".session").c_str(), "r");
+    if (!f) return;
+    char buf[64] = {};
+    if (fgets(buf, sizeof(buf), f)) {
+      try {
+        auto tm = UtcTimeStampConvertor::convert(std::string(buf, 17));
+        header_->creation_time = tm.getTimeT();
+      } catch (...) {
+      }
+    }
+    fclose(f);
   }
 
  private:
-  opentrade::TaskPool pool_;
-  mutable std::mutex m_;
+  struct Header {
+    uint64_t magic;
+    uint64_t ring_size;
+    int64_t creation_time;
+    std::atomic<int> next_sender;
+    std::atomic<int> next_target;
+    std::atomic<uint64_t> write_pos;
+    char pad[4096 - 40];
+  };
+  struct Slot {
+    std::atomic<int> seq;
+    uint32_t len;
+    uint64_t offset;
+  };
+
+  int fd_ = -1;
+  uint64_t size_ = 0;
+  Header* header_ = nullptr;
+  Slot* slots_ = nullptr;
+  char* ring_ = nullptr;
 };
 
-class AsyncFileStoreFactory : public FileStoreFactory {
+// FileStorePath as FileStore, ring size in bytes from the optional
+// session setting FileStoreRingSize
+class MmapFileStoreFactory : public FileStoreFactory {
  public:
-  explicit AsyncFileStoreFactory(const SessionSettings& settings)
+  explicit MmapFileStoreFactory(const SessionSettings& settings)
       : FileStoreFactory(settings) {}
-  explicit AsyncFileStoreFactory(const std::string& path)
+  explicit MmapFileStoreFactory(const std::string& path)
       : FileStoreFactory(path) {}
 
   MessageStore* create(const SessionID& s) override {
-    if (m_path.size()) return new AsyncFileStore(m_path, s);
+    if (m_path.size()) return new MmapFileStore(m_path, s);
 
-    std::string path;
     Dictionary settings = m_settings.get(s);
-    path = settings.getString(FILE_STORE_PATH);
-    return new AsyncFileStore(path, s);
+    auto path = settings.getString(FILE_STORE_PATH);
+    auto ring_size = MmapFileStore::kDefaultRingSize;
+    if (settings.has("FileStoreRingSize"))
+      ring_size = settings.getInt("FileStoreRingSize");
+    return new MmapFileStore(path, s, ring_size);
   }
 };
 
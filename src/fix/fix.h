@@ -1,57 +1,126 @@
 #ifndef FIX_FIX_H_
 #define FIX_FIX_H_
 
+#include <atomic>
 #include <fstream>
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 #define throw(...)
+#define private protected
+#include <quickfix/Session.h>
+#undef private
 #include <quickfix/MessageCracker.h>
 #include <quickfix/NullStore.h>
-#include <quickfix/Session.h>
 #include <quickfix/ThreadedSocketInitiator.h>
 #undef throw
 
+#include "encoder.h"
 #include "filelog.h"
 #include "filestore.h"
+#include "parser.h"
 #include "opentrade/exchange_connectivity.h"
 #include "opentrade/logger.h"
+#include "opentrade/segmented_array.h"
+#include "opentrade/task_pool.h"
 #include "opentrade/utility.h"
 
 namespace opentrade {
 
+// Session internals needed to send pre-encoded messages the way
+// Session::sendRaw does, Session.h is included with private as protected.
+// This ties the adapter to the member names of the QuickFIX version built
+// against, check them when upgrading QuickFIX.
+struct SessionAccess : public FIX::Session {
+  static FIX::Mutex& mutex(FIX::Session* s) {
+    return s->*(&SessionAccess::m_mutex);
+  }
+  static FIX::SessionState& state(FIX::Session* s) {
+    return s->*(&SessionAccess::m_state);
+  }
+  static FIX::Responder* responder(FIX::Session* s) {
+    return s->*(&SessionAccess::m_pResponder);
+  }
+  static bool persist(FIX::Session* s) {
+    return s->*(&SessionAccess::m_persistMessages);
+  }
+};
+
 class Fix : public FIX::Application,
             public FIX::MessageCracker,
             public ExchangeConnectivityAdapter {
  public:
+  // one of the adapter's FIX sessions, with its own encoder and load
+  struct Channel {
+    FIX::Session* session = nullptr;
+    std::atomic<int> connected = 0;
+    std::atomic<int> in_flight = 0;   // sent and not acknowledged yet
+    std::atomic<int64_t> latency = 0;  // moving average of ack latency, ns
+    FixEncoder encoder;
+    std::string raw;
+    std::unordered_map<Security::IdType, FixSegment> segments;
+  };
+
+  // by order id
+  struct OrderRoute {
+    std::atomic<uint8_t> channel;  // index + 1, 0 if not routed
+    std::atomic<int64_t> sent;     // NowInNano() until acknowledged
+  };
+
   void Start() noexcept override {
     auto config_file = config("config_file");
     if (config_file.empty()) LOG_FATAL(name() << ": config_file not given");
     if (!std::ifstream(config_file.c_str()).good())
       LOG_FATAL(name() << ": Faield to open: " << config_file);
 
+    auto routing = config("routing");
+    if (routing == "sub_account")
+      routing_ = kRouteBySubAccount;
+    else if (routing == "security")
+      routing_ = kRouteBySecurity;
+    else if (routing == "latency")
+      routing_ = kRouteByLatency;
+    else if (!routing.empty() && routing != "least_loaded")
+      LOG_FATAL(name() << ": Unknown routing: " << routing);
+    native_send_ = config("native_send") != "0";
+
     fix_settings_.reset(new FIX::SessionSettings(config_file));
     if (empty_store_)
       fix_store_factory_.reset(new FIX::NullStoreFactory());
     else
-      fix_store_factory_.reset(new FIX::AsyncFileStoreFactory(*fix_settings_));
-    fix_log_factory_.reset(new FIX::AsyncFileLogFactory(*fix_settings_));
+      fix_store_factory_.reset(new FIX::MmapFileStoreFactory(*fix_settings_));
+    fix_log_factory_.reset(new FIX::BinaryFileLogFactory(*fix_settings_));
     threaded_socket_initiator_.reset(new FIX::ThreadedSocketInitiator(
         *this, *fix_store_factory_, *fix_settings_, *fix_log_factory_));
     threaded_socket_initiator_->start();
   }
 
+  // called for each session in config_file while Start creates the
+  // initiator, i.e. before any order
   void onCreate(const FIX::SessionID& session_id) override {
-    if (!session_) session_ = FIX::Session::lookupSession(session_id);
+    auto session = FIX::Session::lookupSession(session_id);
+    if (!session_) session_ = session;
+    auto ch = new Channel;
+    ch->session = session;
+    if (!ch->encoder.Init(session_id.getBeginString().getString(),
+                          session_id.getSenderCompID().getString(),
+                          session_id.getTargetCompID().getString()))
+      LOG_FATAL(name() << ": Header of " << session_id.toString()
+                       << " too long for FixEncoder::kHeadRoom");
+    channels_.emplace_back(ch);
   }
 
   void onLogon(const FIX::SessionID& session_id) override {
-    if (session_ != FIX::Session::lookupSession(session_id)) return;
-    connected_ = -1;
+    auto ch = FindChannel(session_id);
+    if (!ch) return;
+    ch->connected = -1;
     // in case frequently reconnected, e.g. seqnum mismatch,
     // OnLogout is called immediately after OnLogon
     tp_.AddTask(
         [=]() {
-          if (-1 == connected_) {
+          if (-1 == ch->connected) {
+            ch->connected = 1;
             connected_ = 1;
             LOG_INFO(name() << ": Logged-in to " << session_id.toString());
           }
@@ -60,10 +129,91 @@ class Fix : public FIX::Application,
   }
 
   void onLogout(const FIX::SessionID& session_id) override {
-    if (session_ != FIX::Session::lookupSession(session_id)) return;
-    if (connected())
+    auto ch = FindChannel(session_id);
+    if (!ch) return;
+    if (ch->connected == 1)
       LOG_INFO(name() << ": Logged-out from " << session_id.toString());
-    connected_ = 0;
+    ch->connected = 0;
+    ch->in_flight = 0;  // acks of those may never come
+    auto any = false;
+    for (auto& c : channels_) any |= c->connected == 1;
+    connected_ = any ? 1 : 0;
+  }
+
+  Channel* FindChannel(const FIX::SessionID& session_id) {
+    for (auto& ch : channels_) {
+      if (ch->session->getSessionID() == session_id) return ch.get();
+    }
+    return nullptr;
+  }
+
+  // New orders go to the session picked by the routing config:
+  // sub_account or security (hash of the id over logged-on sessions),
+  // latency (lowest ack latency) or least_loaded (default, fewest
+  // unacknowledged orders). A cancel always goes to the session which
+  // carried its original order.
+  size_t Route(const Order& ord) noexcept override {
+    auto n = channels_.size();
+    if (n <= 1) return 0;
+    size_t i = 0;
+    if (ord.orig_id) {
+      auto orig = routes_.Get(ord.orig_id);
+      if (orig && orig->channel) i = orig->channel - 1;
+    } else {
+      switch (routing_) {
+        case kRouteBySubAccount:
+          i = Pick(ord.sub_account->id);
+          break;
+        case kRouteBySecurity:
+          i = Pick(ord.sec->id);
+          break;
+        default:
+          i = PickLeastLoaded(routing_ == kRouteByLatency);
+          break;
+      }
+    }
+    routes_[ord.id].channel = i + 1;
+    return i;
+  }
+
+  size_t Pick(uint32_t key) {
+    auto n = channels_.size();
+    for (auto j = 0u; j < n; ++j) {
+      auto i = (key + j) % n;
+      if (channels_[i]->connected == 1) return i;
+    }
+    return key % n;
+  }
+
+  size_t PickLeastLoaded(bool by_latency) {
+    size_t best = 0;
+    auto best_load = std::make_pair(INT64_MAX, INT64_MAX);
+    for (auto i = 0u; i < channels_.size(); ++i) {
+      auto& ch = *channels_[i];
+      if (ch.connected != 1) continue;
+      auto load = by_latency ? std::make_pair(ch.latency.load(),
+                                              int64_t(ch.in_flight.load()))
+                             : std::make_pair(int64_t(ch.in_flight.load()),
+                                              ch.latency.load());
+      if (load < best_load) {
+        best = i;
+        best_load = load;
+      }
+    }
+    return best;
+  }
+
+  // first response to an order sent by Send(const Order&)
+  void Ack(Order::IdType id) {
+    auto route = routes_.Get(id);
+    if (!route) return;
+    auto sent = route->sent.exchange(0);
+    if (!sent || !route->channel) return;
+    auto& ch = *channels_[route->channel - 1];
+    if (ch.in_flight > 0) ch.in_flight--;
+    auto latency = NowInNano() - sent;
+    auto avg = ch.latency.load();
+    ch.latency = avg ? avg + (latency - avg) / 8 : latency;
   }
 
   void toApp(FIX::Message& msg, const FIX::SessionID& session_id) override {
@@ -76,6 +226,21 @@ class Fix : public FIX::Application,
 
   void fromApp(const FIX::Message& msg,
                const FIX::SessionID& session_id) override {
+    // execution reports and cancel rejects are parsed from the receive buffer
+    // instead of the cracked message, unless it is not the one just received,
+    // e.g. queued for a sequence gap
+    auto raw = FIX::BinaryFileLog::incoming;
+    FIX::BinaryFileLog::incoming = nullptr;
+    FixReport report;
+    if (raw && ParseFixReport(raw->data(), raw->size(), &report) &&
+        report.msg_seq_num ==
+            msg.getHeader().getField(FIX::FIELD::MsgSeqNum)) {
+      if (report.msg_type == '8')
+        OnExecutionReport(report);
+      else
+        OnCancelRejected(report);
+      return;
+    }
     crack(msg, session_id);
   }
 
@@ -112,6 +277,8 @@ class Fix : public FIX::Application,
 
   void OnExecutionReport(const FIX::Message& msg,
                          const FIX::SessionID& session_id) {
+    if (msg.isSetField(FIX::FIELD::ClOrdID))
+      Ack(atol(msg.getField(FIX::FIELD::ClOrdID).c_str()));
     UpdateTm(msg);
     std::string text;
     if (msg.isSetField(FIX::FIELD::Text)) text = msg.getField(FIX::FIELD::Text);
@@ -176,7 +343,7 @@ class Fix : public FIX::Application,
       return;
     }
     auto exec_id = msg.getField(FIX::FIELD::ExecID);
-    auto last_shares = atoll(msg.getField(FIX::FIELD::LastShares).c_str());
+    auto last_shares = atof(msg.getField(FIX::FIELD::LastShares).c_str());
     auto last_px = atof(msg.getField(FIX::FIELD::LastPx).c_str());
     auto clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
     HandleFill(clordid, last_shares, last_px, exec_id, transact_time_,
@@ -231,12 +398,62 @@ class Fix : public FIX::Application,
     Order::IdType clordid = 0;
     if (msg.isSetField(FIX::FIELD::ClOrdID))
       clordid = atol(msg.getField(FIX::FIELD::ClOrdID).c_str());
+    Ack(clordid);
     UpdateTm(msg);
     std::string text;
     if (msg.isSetField(FIX::FIELD::Text)) text = msg.getField(FIX::FIELD::Text);
     HandleCancelRejected(clordid, orig_id, text, transact_time_);
   }
 
+  void OnExecutionReport(const FixReport& r) {
+    transact_time_ = r.transact_time ? r.transact_time : NowUtcInMicro();
+    Order::IdType clordid = ParseFixInt(r.cl_ord_id);
+    Order::IdType orig_id = ParseFixInt(r.orig_cl_ord_id);
+    Ack(clordid);
+    switch (r.exec_type) {
+      case FIX::ExecType_PENDING_NEW:
+        HandlePendingNew(clordid, std::string(r.text), transact_time_);
+        break;
+      case FIX::ExecType_PENDING_CANCEL:
+        HandlePendingCancel(clordid, orig_id, transact_time_);
+        break;
+      case FIX::ExecType_NEW:
+      case FIX::ExecType_SUSPENDED:
+        HandleNew(clordid, std::string(r.order_id), transact_time_);
+        break;
+      case FIX::ExecType_PARTIAL_FILL:
+      case FIX::ExecType_FILL:
+      case FIX::ExecType_TRADE:
+        if (r.exec_trans_type == FIX::ExecTransType_CORRECT) {
+          LOG_WARN(name() << ": Ignoring FIX::ExecTransType_CORRECT");
+          break;
+        }
+        HandleFill(clordid, r.last_shares.ToDouble(), r.last_px.ToDouble(),
+                   std::string(r.exec_id), transact_time_,
+                   r.exec_type == FIX::ExecType_PARTIAL_FILL,
+                   static_cast<ExecTransType>(r.exec_trans_type));
+        break;
+      case FIX::ExecType_CANCELED:
+        HandleCanceled(clordid, orig_id, std::string(r.text), transact_time_);
+        break;
+      case FIX::ExecType_REJECTED:
+        HandleNewRejected(clordid, std::string(r.text), transact_time_);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void OnCancelRejected(const FixReport& r) {
+    Order::IdType clordid = ParseFixInt(r.cl_ord_id);
+    Ack(clordid);
+    if (r.cxl_rej_response_to != FIX::CxlRejResponseTo_ORDER_CANCEL_REQUEST)
+      return;  // to-do: replace rejected
+    transact_time_ = r.transact_time ? r.transact_time : NowUtcInMicro();
+    HandleCancelRejected(clordid, ParseFixInt(r.orig_cl_ord_id),
+                         std::string(r.text), transact_time_);
+  }
+
   void SetTags(const Order& ord, FIX::Message* msg) {
     if (!ord.orig_id) {  // not cancel
       if (ord.type != kMarket) {
@@ -263,18 +480,152 @@ class Fix : public FIX::Application,
     }
   }
 
+  // same tags as above, written by the native encoder
+  void SetTags(const Order& ord, FixEncoder* enc) {
+    if (!ord.orig_id) {  // not cancel
+      if (ord.type != kMarket) enc->Add(FIX::FIELD::Price, ord.price);
+      if (ord.stop_price) enc->Add(FIX::FIELD::StopPx, ord.stop_price);
+      enc->Add(FIX::FIELD::TimeInForce, static_cast<char>(ord.tif));
+    } else {
+      enc->Add(FIX::FIELD::OrigClOrdID, static_cast<int64_t>(ord.orig_id));
+    }
+
+    enc->Add(FIX::FIELD::OrderQty, ord.qty);
+    enc->Add(FIX::FIELD::ClOrdID, static_cast<int64_t>(ord.id));
+    enc->Add(FIX::FIELD::Side, static_cast<char>(ord.side));
+    if (ord.side == kShort) enc->Add(FIX::FIELD::LocateReqd, 'N');
+    enc->AddTime(FIX::FIELD::TransactTime, NowUtcInMicro());
+    enc->Add(FIX::FIELD::OrdType, static_cast<char>(ord.type));
+  }
+
+  // tags depending only on the security, rendered once per security
+  virtual void SetSecurityTags(const Security& sec, FixSegment* seg) {
+    seg->Add(FIX::FIELD::HandlInst, '1');
+    if (sec.type == kOption) {
+      seg->Add(FIX::FIELD::PutOrCall, sec.put_or_call ? '1' : '0');
+      seg->Add(FIX::FIELD::OptAttribute, 'A');
+      seg->Add(FIX::FIELD::StrikePrice, FIX::DoubleConvertor::convert(
+                                            sec.strike_price));
+    }
+  }
+
+  const FixSegment& GetSegment(Channel* ch, const Security& sec) {
+    auto& seg = ch->segments[sec.id];
+    if (seg.bytes.empty()) SetSecurityTags(sec, &seg);
+    return seg;
+  }
+
   bool Send(FIX::Message* msg) { return session_->send(*msg); }
 
+  // ord as a FIX::Message with the same tags as encoded by Send, the
+  // security's segment parsed back into fields
+  void SetMessage(const Order& ord, Channel* ch, FIX::Message* msg) {
+    msg->getHeader().setField(FIX::MsgType(
+        ord.orig_id ? FIX::MsgType_OrderCancelRequest
+                    : FIX::MsgType_NewOrderSingle));
+    SetTags(ord, msg);
+    auto& seg = GetSegment(ch, *ord.sec).bytes;
+    for (size_t i = 0; i < seg.size();) {
+      auto eq = seg.find('=', i);
+      auto end = seg.find('\x01', eq);
+      msg->setField(atoi(seg.c_str() + i), seg.substr(eq + 1, end - eq - 1));
+      i = end + 1;
+    }
+  }
+
+  // NewOrderSingle, or OrderCancelRequest if ord.orig_id, encoded without
+  // FIX::Message and handed to the routed session's socket directly. This
+  // differs from Session::send in two ways:
+  // - toApp is not called, so anything an adapter adds or vetoes there does
+  //   not apply.
+  // - it needs the session logged on.
+  // Hence the message is parsed into a FIX::Message and given to
+  // Session::send instead if the adapter config native_send is 0, e.g. for
+  // adapters overriding toApp, or if the session is not logged on, in which
+  // case QuickFIX stores it and resends it after logon as it always did. A
+  // message too long for the encoder is built by SetMessage and goes through
+  // Session::send likewise.
+  bool Send(const Order& ord) {
+    auto route = routes_.Get(ord.id);
+    auto i = route && route->channel ? route->channel - 1 : Route(ord);
+    if (i >= channels_.size()) return false;
+    auto ch = channels_[i].get();
+    auto session = ch->session;
+    std::string raw;
+    {
+      FIX::Locker lock(SessionAccess::mutex(session));
+      auto& enc = ch->encoder;
+      enc.Begin(ord.orig_id ? FIX::MsgType_OrderCancelRequest
+                            : FIX::MsgType_NewOrderSingle);
+      SetTags(ord, &enc);
+      enc.Add(GetSegment(ch, *ord.sec));
+      if (!enc.overflow()) {
+        if (native_send_ && session->isLoggedOn())
+          return SendRaw(ord, ch, NowUtcInMicro());
+        // header is filled in again by Session::send
+        auto msg = enc.Finish(0, NowUtcInMicro());
+        raw.assign(msg.first, msg.second);
+      }
+    }
+    try {
+      FIX::Message msg;
+      if (raw.empty())
+        SetMessage(ord, ch, &msg);  // too long for the encoder
+      else
+        msg.setString(raw, false);
+      return session->send(msg);
+    } catch (const FIX::Exception& e) {
+      LOG_ERROR(name() << ": Failed to send: " << e.what());
+      return false;
+    }
+  }
+
+  // sends ord as encoded into ch->encoder the way Session::sendRaw does,
+  // called with the session mutex held
+  bool SendRaw(const Order& ord, Channel* ch, int64_t utc_micro) {
+    auto session = ch->session;
+    auto& state = SessionAccess::state(session);
+    auto& enc = ch->encoder;
+    auto seq = state.getNextSenderMsgSeqNum();
+    auto msg = enc.Finish(seq, utc_micro);
+    if (!msg.first) return false;
+    ch->raw.assign(msg.first, msg.second);
+    state.lastSentTime(FIX::UtcTimeStamp());
+    if (SessionAccess::persist(session)) state.set(seq, ch->raw);
+    state.incrNextSenderMsgSeqNum();
+    state.onOutgoing(ch->raw);
+    // stamped before the write, the ack may be handled before send returns
+    auto track = channels_.size() > 1;
+    if (track) {
+      ch->in_flight++;
+      routes_[ord.id].sent = NowInNano();
+    }
+    auto responder = SessionAccess::responder(session);
+    if (responder && responder->send(ch->raw)) return true;
+    if (track && routes_[ord.id].sent.exchange(0)) ch->in_flight--;
+    return false;
+  }
+
  protected:
   std::unique_ptr<FIX::SessionSettings> fix_settings_;
   std::unique_ptr<FIX::MessageStoreFactory> fix_store_factory_;
   std::unique_ptr<FIX::LogFactory> fix_log_factory_;
   std::unique_ptr<FIX::ThreadedSocketInitiator> threaded_socket_initiator_;
-  FIX::Session* session_ = nullptr;
+  FIX::Session* session_ = nullptr;  // the first one
+  std::vector<std::unique_ptr<Channel>> channels_;
+  SegmentedArray<OrderRoute> routes_;
+  enum Routing {
+    kRouteByLoad,
+    kRouteByLatency,
+    kRouteBySubAccount,
+    kRouteBySecurity,
+  } routing_ = kRouteByLoad;
 
-  int64_t transact_time_ = 0;
+  // set and read on the session's own receiving thread
+  static inline thread_local int64_t transact_time_ = 0;
   TaskPool tp_;
   bool empty_store_ = false;
+  bool native_send_ = true;  // see Send(const Order&)
 };  // namespace opentrade
 
 }  // namespace opentrade
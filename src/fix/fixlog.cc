@@ -0,0 +1,96 @@
+// Decodes binary FIX log segments into QuickFIX FileLog style text, i.e.
+// "YYYYMMDD-HH:MM:SS.uuuuuu : message" per line.
+// usage: fixlog [-e] [-d] [-p] file.binlog...
+//   -e  include events, -d  prefix direction (I/O/E), -p  print SOH as '|'
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "binlog.h"
+
+using opentrade::BinLogRecord;
+using opentrade::BinLogSegment;
+
+static bool Decode(const char* fn, bool events, bool dir, bool pipe) {
+  auto f = fopen(fn, "rb");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s: %s\n", fn, strerror(errno));
+    return false;
+  }
+  BinLogSegment seg;
+  if (fread(&seg, sizeof(seg), 1, f) != 1 ||
+      memcmp(seg.magic, BinLogSegment::kMagic, sizeof(seg.magic))) {
+    fprintf(stderr, "%s: not a binary FIX log\n", fn);
+    fclose(f);
+    return false;
+  }
+  BinLogRecord rec;
+  std::vector<char> msg;
+  // current anchor, moved to each sync record, see BinLogSegment
+  auto tsc0 = seg.tsc0;
+  auto utc_ns0 = seg.utc_ns0;
+  auto ticks_per_ns = seg.ticks_per_ns;
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    msg.resize((rec.len + 7) & ~7u);
+    if (fread(msg.data(), 1, msg.size(), f) != msg.size()) {
+      fprintf(stderr, "%s: truncated record\n", fn);
+      break;
+    }
+    if (rec.dir == BinLogRecord::kSync) {
+      int64_t utc_ns;
+      if (rec.len != sizeof(utc_ns)) continue;
+      memcpy(&utc_ns, msg.data(), sizeof(utc_ns));
+      if (utc_ns > utc_ns0 && rec.tsc > tsc0)
+        ticks_per_ns = static_cast<double>(rec.tsc - tsc0) / (utc_ns - utc_ns0);
+      tsc0 = rec.tsc;
+      utc_ns0 = utc_ns;
+      continue;
+    }
+    if (rec.dir == BinLogRecord::kEvent && !events) continue;
+    auto ns = utc_ns0 + static_cast<int64_t>(
+                            static_cast<int64_t>(rec.tsc - tsc0) /
+                            ticks_per_ns);
+    time_t secs = ns / 1000000000;
+    struct tm tm_info;
+    gmtime_r(&secs, &tm_info);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y%m%d-%H:%M:%S", &tm_info);
+    if (pipe) {
+      for (auto i = 0u; i < rec.len; ++i)
+        if (msg[i] == '\x01') msg[i] = '|';
+    }
+    if (dir) printf("%c ", rec.dir);
+    printf("%s.%06ld : %.*s\n", ts, static_cast<long>(ns % 1000000000 / 1000),
+           static_cast<int>(rec.len), msg.data());
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  auto events = false;
+  auto dir = false;
+  auto pipe = false;
+  std::vector<const char*> files;
+  for (auto i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-e"))
+      events = true;
+    else if (!strcmp(argv[i], "-d"))
+      dir = true;
+    else if (!strcmp(argv[i], "-p"))
+      pipe = true;
+    else
+      files.push_back(argv[i]);
+  }
+  if (files.empty()) {
+    fprintf(stderr, "usage: %s [-e] [-d] [-p] file.binlog...\n", argv[0]);
+    return 1;
+  }
+  auto ok = true;
+  for (auto fn : files) ok = Decode(fn, events, dir, pipe) && ok;
+  return ok ? 0 : 1;
+}
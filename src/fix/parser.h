@@ -0,0 +1,169 @@
+#ifndef FIX_PARSER_H_
+#define FIX_PARSER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace opentrade {
+
+// Decimal as sent on the wire, e.g. "100.25" is {10025, 2}, so that
+// fractional quantities and prices are kept exactly until converted.
+struct FixDecimal {
+  int64_t mantissa = 0;
+  int scale = 0;
+
+  double ToDouble() const {
+    static const double kPow10[] = {1,   1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6, 1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17};
+    return mantissa / kPow10[scale];
+  }
+};
+
+// Fields of ExecutionReport (35=8) and OrderCancelReject (35=9) used by the
+// Fix adapter. Strings are views into the parsed buffer.
+struct FixReport {
+  char msg_type = 0;
+  std::string_view msg_seq_num;
+  std::string_view cl_ord_id;
+  std::string_view orig_cl_ord_id;
+  std::string_view order_id;
+  std::string_view exec_id;
+  std::string_view text;
+  char exec_type = 0;
+  char exec_trans_type = '0';  // absent since FIX 4.3, i.e. new
+  char cxl_rej_response_to = 0;
+  FixDecimal last_shares;
+  FixDecimal last_px;
+  int64_t transact_time = 0;  // utc in microseconds, 0 if absent
+};
+
+static inline int64_t ParseFixInt(std::string_view v) {
+  int64_t x = 0;
+  auto neg = !v.empty() && v[0] == '-';
+  for (auto i = neg ? 1u : 0u; i < v.size(); ++i) {
+    auto d = static_cast<unsigned>(v[i] - '0');
+    if (d > 9) break;
+    x = x * 10 + d;
+  }
+  return neg ? -x : x;
+}
+
+static inline FixDecimal ParseFixDecimal(std::string_view v) {
+  FixDecimal x;
+  auto neg = !v.empty() && v[0] == '-';
+  auto dot = false;
+  for (auto i = neg ? 1u : 0u; i < v.size(); ++i) {
+    if (v[i] == '.') {
+      dot = true;
+      continue;
+    }
+    auto d = static_cast<unsigned>(v[i] - '0');
+    if (d > 9) break;
+    if (dot) {
+      if (x.scale == 17) continue;  // beyond double precision anyway
+      x.scale++;
+    }
+    x.mantissa = x.mantissa * 10 + d;
+  }
+  if (neg) x.mantissa = -x.mantissa;
+  return x;
+}
+
+// YYYYMMDD-HH:MM:SS[.fraction] to utc in microseconds, 0 if malformed
+static inline int64_t ParseFixUtcTimestamp(std::string_view v) {
+  if (v.size() < 17 || v[8] != '-') return 0;
+  auto num = [&v](int pos, int n) {
+    int x = 0;
+    for (auto i = pos; i < pos + n; ++i) x = x * 10 + (v[i] - '0');
+    return x;
+  };
+  int y = num(0, 4);
+  unsigned m = num(4, 2);
+  unsigned d = num(6, 2);
+  // days since 1970-01-01 of civil date, proleptic Gregorian
+  y -= m <= 2;
+  auto era = (y >= 0 ? y : y - 399) / 400;
+  auto yoe = static_cast<unsigned>(y - era * 400);
+  auto doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  auto doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = era * 146097 + static_cast<int>(doe) - 719468;
+  int64_t secs = days * 86400 + num(9, 2) * 3600 + num(12, 2) * 60 +
+                 num(15, 2);
+  int64_t micros = 0;
+  auto n = 0;
+  if (v.size() > 18 && v[17] == '.') {
+    for (auto i = 18u; i < v.size() && n < 6; ++i, ++n)
+      micros = micros * 10 + (v[i] - '0');
+  }
+  for (; n < 6; ++n) micros *= 10;
+  return secs * 1000000 + micros;
+}
+
+// Scans tag=value<SOH> pairs of one message in place, no copy and no
+// allocation. Returns false if it is neither ExecutionReport nor
+// OrderCancelReject, in which case parsing stops right after MsgType.
+static inline bool ParseFixReport(const char* p, size_t n, FixReport* r) {
+  *r = FixReport{};
+  auto end = p + n;
+  while (p < end) {
+    int tag = 0;
+    for (; p < end && *p != '='; ++p) tag = tag * 10 + (*p - '0');
+    if (p == end) break;
+    auto value = ++p;
+    p = static_cast<const char*>(std::memchr(p, '\x01', end - p));
+    if (!p) p = end;
+    std::string_view v(value, p - value);
+    p++;
+    switch (tag) {
+      case 35:  // MsgType
+        if (v.size() != 1 || (v[0] != '8' && v[0] != '9')) return false;
+        r->msg_type = v[0];
+        break;
+      case 34:  // MsgSeqNum
+        r->msg_seq_num = v;
+        break;
+      case 11:  // ClOrdID
+        r->cl_ord_id = v;
+        break;
+      case 41:  // OrigClOrdID
+        r->orig_cl_ord_id = v;
+        break;
+      case 37:  // OrderID
+        r->order_id = v;
+        break;
+      case 17:  // ExecID
+        r->exec_id = v;
+        break;
+      case 58:  // Text
+        r->text = v;
+        break;
+      case 150:  // ExecType
+        if (!v.empty()) r->exec_type = v[0];
+        break;
+      case 20:  // ExecTransType
+        if (!v.empty()) r->exec_trans_type = v[0];
+        break;
+      case 434:  // CxlRejResponseTo
+        if (!v.empty()) r->cxl_rej_response_to = v[0];
+        break;
+      case 32:  // LastShares
+        r->last_shares = ParseFixDecimal(v);
+        break;
+      case 31:  // LastPx
+        r->last_px = ParseFixDecimal(v);
+        break;
+      case 60:  // TransactTime
+        r->transact_time = ParseFixUtcTimestamp(v);
+        break;
+      default:
+        break;
+    }
+  }
+  return r->msg_type != 0;
+}
+
+}  // namespace opentrade
+
+#endif  // FIX_PARSER_H_
@@ -65,6 +65,7 @@ void AccountManager::Initialize() {
     b->set_params(Database::GetValue(*it, i++, kEmptyStr));
     b->limits = ParseLimits(Database::GetValue(*it, i++, kEmptyStr));
     self.broker_accounts_.emplace(b->id, b);
+    self.broker_account_of_name_.emplace(b->name, b);
   }
 
   query = R"(
@@ -132,11 +133,17 @@ Limits ParseLimits(const std::string& limits_str) {
   for (auto& str : Split(limits_str, ",;\n")) {
     char name[str.size()];
     double value;
-    if (sscanf(str.c_str(), "%s=%lf", name, &value) != 2) continue;
+    if (sscanf(str.c_str(), "%[^=]=%lf", name, &value) != 2) continue;
     if (!strcasecmp(name, "msg_rate"))
       limits.msg_rate = value;
     else if (!strcasecmp(name, "msg_rate_per_security"))
       limits.msg_rate_per_security = value;
+    else if (!strcasecmp(name, "msg_burst"))
+      limits.msg_burst = value;
+    else if (!strcasecmp(name, "msg_burst_per_security"))
+      limits.msg_burst_per_security = value;
+    else if (!strcasecmp(name, "msg_queue_ms"))
+      limits.msg_queue_ms = value;
     else if (!strcasecmp(name, "order_qty"))
       limits.order_qty = value;
     else if (!strcasecmp(name, "order_value"))
@@ -149,6 +156,14 @@ Limits ParseLimits(const std::string& limits_str) {
       limits.total_value = value;
     else if (!strcasecmp(name, "total_turnover"))
       limits.total_turnover = value;
+    else if (!strcasecmp(name, "sector_value"))
+      limits.sector_value = value;
+    else if (!strcasecmp(name, "industry_group_value"))
+      limits.industry_group_value = value;
+    else if (!strcasecmp(name, "industry_value"))
+      limits.industry_value = value;
+    else if (!strcasecmp(name, "sub_industry_value"))
+      limits.sub_industry_value = value;
   }
   return limits;
 }
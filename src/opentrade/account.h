@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "security.h"
+#include "segmented_array.h"
 #include "utility.h"
 
 namespace opentrade {
@@ -15,10 +16,30 @@ class ExchangeConnectivityAdapter;
 
 struct AccountBase {
   Limits limits;
-  Throttle throttle_in_sec;
-  tbb::concurrent_unordered_map<Security::IdType, Throttle>
-      throttle_per_security_in_sec;
+  Throttle throttle;
+  // directly indexed by security id, allocated on first use since only
+  // accounts with msg_rate_per_security need it
+  std::atomic<SegmentedArray<Throttle>*> throttle_per_security = nullptr;
   PositionValue position_value;
+
+  // nullptr if no message sent on the security yet
+  const Throttle* GetThrottle(Security::IdType id) const {
+    auto throttles = throttle_per_security.load(std::memory_order_acquire);
+    return throttles ? throttles->Get(id) : nullptr;
+  }
+  Throttle& GetThrottle(Security::IdType id) {
+    auto throttles = throttle_per_security.load(std::memory_order_acquire);
+    if (!throttles) {
+      auto tmp = new SegmentedArray<Throttle>();
+      if (throttle_per_security.compare_exchange_strong(
+              throttles, tmp, std::memory_order_acq_rel)) {
+        throttles = tmp;
+      } else {
+        delete tmp;
+      }
+    }
+    return (*throttles)[id];
+  }
 };
 
 struct BrokerAccount : public AccountBase {
@@ -79,6 +100,9 @@ class AccountManager : public Singleton<AccountManager> {
   const BrokerAccount* GetBrokerAccount(BrokerAccount::IdType id) {
     return FindInMap(broker_accounts_, id);
   }
+  const BrokerAccount* GetBrokerAccount(const std::string& name) {
+    return FindInMap(broker_account_of_name_, name);
+  }
 
  private:
   tbb::concurrent_unordered_map<User::IdType, User*> users_;
@@ -87,6 +111,8 @@ class AccountManager : public Singleton<AccountManager> {
   tbb::concurrent_unordered_map<std::string, SubAccount*> sub_account_of_name_;
   tbb::concurrent_unordered_map<BrokerAccount::IdType, BrokerAccount*>
       broker_accounts_;
+  tbb::concurrent_unordered_map<std::string, BrokerAccount*>
+      broker_account_of_name_;
   friend class Connection;
 };
 
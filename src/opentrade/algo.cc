@@ -18,6 +18,10 @@ namespace opentrade {
 static auto kPath = fs::path(".") / "store" / "algos";
 extern TaskPool kWriteTaskPool;
 static thread_local std::string kError;
+// stamps of the market data callback running on this thread, taken by the
+// orders it places, see OrderTimes
+static thread_local int64_t kTickTime;
+static thread_local int64_t kDispatchTime;
 
 inline void AlgoRunner::operator()() {
   assert(std::this_thread::get_id() == tid_);
@@ -48,10 +52,13 @@ inline void AlgoRunner::operator()() {
         AlgoManager::Instance().md_refs_[key]--;
         continue;
       }
+      kTickTime = md.tick_ns;
+      kDispatchTime = NowInNano();
       if (trade_update) algo.OnMarketTrade(**it, md, md0);
       if (quote_update) algo.OnMarketQuote(**it, md, md0);
       it++;
     }
+    kTickTime = kDispatchTime = 0;
     md0 = md;
   }
 }
@@ -139,9 +146,12 @@ void AlgoManager::Run(int nthreads) {
   }
 }
 
-void AlgoManager::Handle(Confirmation::Ptr cm) {
+void AlgoManager::Handle(const Confirmation::Ptr& cm) {
   assert(cm->order->inst);
   assert(cm->order->id > 0);
+  // a cancel request failed, the original order is not affected and the
+  // algo never placed the request itself
+  if (cm->exec_type == kRiskRejected && cm->order->orig_id) return;
   auto inst = const_cast<Instrument*>(cm->order->inst);
   static std::mutex kMutex;
   {
@@ -166,6 +176,7 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
         break;
       case kCanceled:
       case kRejected:
+      case kRiskRejected:
       case kExpired:
       case kCalculated:
       case kDoneForDay:
@@ -187,19 +198,20 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
       case kPartiallyFilled:
       case kFilled:
         if (!cm->order->IsLive()) inst->active_orders_.erase(cm->order);
-        inst->algo().OnConfirmation(*cm.get());
+        inst->algo().OnConfirmation(*cm);
         break;
       case kCanceled:
       case kRejected:
+      case kRiskRejected:
       case kExpired:
       case kCalculated:
       case kDoneForDay:
         inst->active_orders_.erase(cm->order);
-        inst->algo().OnConfirmation(*cm.get());
+        inst->algo().OnConfirmation(*cm);
         break;
       case kPendingCancel:
       case kCancelRejected:
-        inst->algo().OnConfirmation(*cm.get());
+        inst->algo().OnConfirmation(*cm);
         break;
       default:
         break;
@@ -323,25 +335,76 @@ void AlgoManager::SetTimeout(Algo::IdType id, std::function<void()> func,
   }));
 }
 
-Order* Algo::Place(const Contract& contract, Instrument* inst) {
-  if (!is_active_) return nullptr;
-  assert(inst);
-  auto ord = new Order{};
-  (Contract&)* ord = contract;
-  ord->algo_id = id_;
-  ord->user = user_;
-  ord->inst = inst;
-  ord->sec = &inst->sec();
-  auto ok = ExchangeConnectivityManager::Instance().Place(ord);
-  if (!ok) return nullptr;
+// registered before placing, since once numbered the order may be risk
+// rejected later, e.g. held by message rate pacing, and the rejection undoes
+// this in AlgoManager::Handle
+void Algo::Register(Order* ord, Instrument* inst) {
   inst->active_orders_.insert(ord);
   if (ord->IsBuy())
     inst->outstanding_buy_qty_ += ord->qty;
   else
     inst->outstanding_sell_qty_ += ord->qty;
+}
+
+// rejected before numbered, never seen by AlgoManager
+void Algo::Unregister(Order* ord, Instrument* inst) {
+  inst->active_orders_.erase(ord);
+  if (ord->IsBuy())
+    inst->outstanding_buy_qty_ -= ord->qty;
+  else
+    inst->outstanding_sell_qty_ -= ord->qty;
+}
+
+Order* Algo::NewOrder(const Contract& contract, Instrument* inst) {
+  auto ord = GlobalOrderBook::Instance().NewOrder();
+  (Contract&)* ord = contract;
+  ord->algo_id = id_;
+  ord->user = user_;
+  ord->inst = inst;
+  ord->sec = &inst->sec();
+  ord->times.tick = kTickTime;
+  ord->times.dispatch = kDispatchTime;
   return ord;
 }
 
+Order* Algo::Place(const Contract& contract, Instrument* inst) {
+  if (!is_active_) return nullptr;
+  assert(inst);
+  auto ord = NewOrder(contract, inst);
+  Register(ord, inst);
+  auto ok = ExchangeConnectivityManager::Instance().Place(ord);
+  if (ok) return ord;
+  if (!ord->id) Unregister(ord, inst);
+  return nullptr;
+}
+
+std::vector<Order*> Algo::Place(
+    const std::vector<std::pair<Contract, Instrument*>>& orders,
+    bool all_or_none) {
+  std::vector<Order*> ords;
+  if (!is_active_) {
+    ords.resize(orders.size());
+    return ords;
+  }
+  ords.reserve(orders.size());
+  for (auto& pair : orders) {
+    assert(pair.second);
+    auto ord = NewOrder(pair.first, pair.second);
+    Register(ord, pair.second);
+    ords.push_back(ord);
+  }
+  ExchangeConnectivityManager::Instance().PlaceBatch(ords, all_or_none);
+  for (auto& ord : ords) {
+    if (!ord->id) {
+      Unregister(ord, const_cast<Instrument*>(ord->inst));
+      ord = nullptr;
+    } else if (ord->status == kRiskRejected) {
+      ord = nullptr;
+    }
+  }
+  return ords;
+}
+
 bool Algo::Cancel(const Order& ord) {
   return ExchangeConnectivityManager::Instance().Cancel(ord);
 }
@@ -26,6 +26,7 @@
 namespace opentrade {
 
 class Instrument;
+struct LatencyStats;
 
 typedef std::tuple<DataSrc::IdType, const Security*, const SubAccount*,
                    OrderSide, double>
@@ -58,6 +59,10 @@ class Algo : public Adapter {
   void Stop();
   void SetTimeout(std::function<void()> func, uint32_t milliseconds);
   Order* Place(const Contract& contract, Instrument* inst);
+  // basket with one pass of risk check, nullptr for orders failed
+  std::vector<Order*> Place(
+      const std::vector<std::pair<Contract, Instrument*>>& orders,
+      bool all_or_none = false);
   bool Cancel(const Order& ord);
 
   virtual std::string OnStart(const ParamMap& params) noexcept = 0;
@@ -78,13 +83,20 @@ class Algo : public Adapter {
   const std::string& token() const { return token_; }
   const User& user() const { return *user_; }
 
+ private:
+  Order* NewOrder(const Contract& contract, Instrument* inst);
+  static void Register(Order* ord, Instrument* inst);
+  static void Unregister(Order* ord, Instrument* inst);
+
  private:
   const User* user_ = nullptr;
   bool is_active_ = true;
   IdType id_ = 0;
   std::string token_;
   std::set<Instrument*> instruments_;
+  mutable std::atomic<LatencyStats*> latency_stats_ = nullptr;
   friend class AlgoManager;
+  friend class LatencyMonitor;
 };
 
 class Instrument {
@@ -93,6 +105,7 @@ class Instrument {
   Instrument(Algo* algo, const Security& sec, DataSrc::IdType src)
       : algo_(algo), sec_(sec), src_(src) {}
   Algo& algo() { return *algo_; }
+  const Algo& algo() const { return *algo_; }
   const Security& sec() const { return sec_; }
   DataSrc::IdType src() const { return src_; }
   const MarketData& md() const { return *md_; }
@@ -158,7 +171,7 @@ class AlgoManager : public AdapterManager<Algo>, public Singleton<AlgoManager> {
   void Stop();
   void Stop(Security::IdType id);
   void Stop(const std::string& token);
-  void Handle(Confirmation::Ptr cm);
+  void Handle(const Confirmation::Ptr& cm);
   void SetTimeout(Algo::IdType id, std::function<void()> func,
                   uint32_t milliseconds);
   bool IsSubscribed(DataSrc::IdType src, Security::IdType id) {
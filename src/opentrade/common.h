@@ -1,8 +1,10 @@
 #ifndef OPENTRADE_COMMON_H_
 #define OPENTRADE_COMMON_H_
 
-#include <tbb/atomic.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <string>
 
 namespace opentrade {
@@ -24,28 +26,56 @@ class Singleton {
 struct Limits {
   double msg_rate = 0;               // per second
   double msg_rate_per_security = 0;  // per security per second
+  // messages allowed at once after idle, default to one second of rate
+  double msg_burst = 0;
+  double msg_burst_per_security = 0;
+  // sub account only, hold orders breaching message rate for up to this long
+  // and send them once rate allows, instead of rejecting
+  double msg_queue_ms = 0;
   double order_qty = 0;
   double order_value = 0;
   double value = 0;  // per security
   double turnover = 0;
   double total_value = 0;
   double total_turnover = 0;
+  // net value per GICS sector, industry group, industry and sub industry
+  double sector_value = 0;
+  double industry_group_value = 0;
+  double industry_value = 0;
+  double sub_industry_value = 0;
 };
 
+// Message rate limiter of generic cell rate algorithm, equivalent to a token
+// bucket of burst messages refilled continuously at rate per second. The only
+// state is the theoretical arrival time (tat) of the next message at rate, in
+// nanoseconds of NowInNano(), so it is lock-free and, unlike counting
+// messages per calendar second, does not allow double bursts around second
+// boundaries.
 struct Throttle {
-  tbb::atomic<int> n = 0;
-  int operator()(int tm) const {
-    if (tm != this->tm) return 0;
-    return n;
+  std::atomic<int64_t> tat = 0;
+
+  // messages in the bucket at now, i.e. sent and not yet drained at rate
+  double operator()(int64_t now, double rate) const {
+    auto t = tat.load(std::memory_order_relaxed);
+    return t > now ? (t - now) * rate / 1e9 : 0;
   }
-  int tm = 0;
 
-  void Update(int tm2) {
-    if (tm2 != tm) {
-      n = 0;
-      tm2 = tm;
-    } else {
-      n++;
+  // nanoseconds until one more message conforms, 0 if it does at now
+  int64_t GetWait(int64_t now, double rate, double burst) const {
+    auto t = tat.load(std::memory_order_relaxed);
+    auto wait = t - now - static_cast<int64_t>((burst - 1) * 1e9 / rate);
+    return wait > 0 ? wait : 0;
+  }
+
+  bool Check(int64_t now, double rate, double burst) const {
+    return !GetWait(now, rate, burst);
+  }
+
+  void Update(int64_t now, double rate) {
+    auto interval = static_cast<int64_t>(1e9 / rate);
+    auto t = tat.load(std::memory_order_relaxed);
+    while (!tat.compare_exchange_weak(t, std::max(t, now) + interval,
+                                      std::memory_order_relaxed)) {
     }
   }
 };
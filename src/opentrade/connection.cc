@@ -1,13 +1,14 @@
 #include "connection.h"
 
 #include <unistd.h>
-#include <boost/filesystem.hpp>
 #include <boost/uuid/sha1.hpp>
+#include <limits>
 #include <thread>
 
 #include "3rd/json.hpp"
 #include "algo.h"
 #include "exchange_connectivity.h"
+#include "latency.h"
 #include "logger.h"
 #include "market_data.h"
 #include "position.h"
@@ -15,7 +16,6 @@
 #include "server.h"
 
 using json = nlohmann::json;
-namespace fs = boost::filesystem;
 
 namespace opentrade {
 
@@ -274,6 +274,7 @@ void Connection::PublishMarketdata() {
     if (j.size() > 1) {
       self->Send(j.dump());
     }
+    if (self->sub_exposure_) self->PublishExposure();
     if (!self->sub_pnl_) return;
     auto sub_accounts = self->user_->sub_accounts;
     for (auto& pair : PositionManager::Instance().sub_positions_) {
@@ -313,6 +314,35 @@ void Connection::PublishMarketdata() {
   }));
 }
 
+void Connection::PublishExposure() {
+  static const char* kLevels[kNumGicsLevels] = {
+      "sector",
+      "industry_group",
+      "industry",
+      "sub_industry",
+  };
+  auto sub_accounts = user_->sub_accounts;
+  for (auto& pair : PositionManager::Instance().exposures_) {
+    auto key = pair.first;
+    SubAccount::IdType sub_account_id = key >> 40;
+    if (sub_accounts->find(sub_account_id) == sub_accounts->end()) continue;
+    auto& e = pair.second;
+    auto& e0 = exposures_[key];
+    if (e.net == e0.first && e.gross == e0.second) continue;
+    e0.first = e.net;
+    e0.second = e.gross;
+    json j = {
+        "exposure",
+        sub_account_id,
+        kLevels[(key >> 32) & 0xFF],
+        static_cast<uint32_t>(key),
+        e.net,
+        e.gross,
+    };
+    Send(j.dump());
+  }
+}
+
 template <typename T>
 static inline bool JsonifyScala(const T& v, json* j) {
   if (auto p_val = std::get_if<bool>(&v)) {
@@ -582,6 +612,7 @@ void Connection::OnMessage(const std::string& msg) {
               std::chrono::milliseconds(static_cast<int>(interval * 1000)));
           GlobalOrderBook::Instance().Cancel();
         }
+        ExchangeConnectivityManager::Instance().Stop();
         std::this_thread::sleep_for(std::chrono::seconds(1));
         // to-do: safe exit
         if (system(("kill -9 " + std::to_string(getpid())).c_str())) return;
@@ -596,6 +627,65 @@ void Connection::OnMessage(const std::string& msg) {
           return;
         }
         ExchangeConnectivityManager::Instance().Cancel(*ord);
+      } else if (action == "mass_cancel") {
+        auto scope_str = Get<std::string>(j[1]);
+        auto is_admin = self->user_->is_admin;
+        auto scope = kLiveBySubAccount;
+        uint32_t id = 0;
+        std::string err;
+        if (scope_str == "sub_account") {
+          auto name = Get<std::string>(j[2]);
+          auto acc = AccountManager::Instance().GetSubAccount(name);
+          auto accs = self->user_->sub_accounts;
+          scope = kLiveBySubAccount;
+          if (!acc)
+            err = "Invalid sub_account: " + name;
+          else if (!is_admin && accs->find(acc->id) == accs->end())
+            err = "No permission on sub_account: " + name;
+          else
+            id = acc->id;
+        } else if (scope_str == "user") {
+          auto name = Get<std::string>(j[2]);
+          auto user = AccountManager::Instance().GetUser(name);
+          scope = kLiveByUser;
+          if (!user)
+            err = "Invalid user: " + name;
+          else if (!is_admin && user != self->user_)
+            err = "No permission on user: " + name;
+          else
+            id = user->id;
+        } else if (scope_str == "broker_account") {
+          auto n = Get<int64_t>(j[2]);
+          scope = kLiveByBrokerAccount;
+          if (!is_admin)
+            err = "Admin only";
+          else if (!AccountManager::Instance().GetBrokerAccount(n))
+            err = "Invalid broker_account id: " + std::to_string(n);
+          else
+            id = n;
+        } else if (scope_str == "security") {
+          auto n = Get<int64_t>(j[2]);
+          scope = kLiveBySecurity;
+          if (!is_admin)
+            err = "Admin only";
+          else if (!SecurityManager::Instance().Get(n))
+            err = "Invalid security id: " + std::to_string(n);
+          else
+            id = n;
+        } else {
+          err = "Invalid scope: " + scope_str;
+        }
+        if (!err.empty()) {
+          json j = {"error", "mass_cancel", scope_str, err};
+          LOG_DEBUG(self->GetAddress() << ": " << j << '\n' << msg);
+          self->Send(j.dump());
+          return;
+        }
+        auto n = GlobalOrderBook::Instance().Cancel(scope, id);
+        LOG_INFO(self->GetAddress() << ": Mass cancel of " << scope_str << ' '
+                                    << id << ", " << n << " live orders");
+        json j = {"mass_cancel", scope_str, id, n};
+        self->Send(j.dump());
       } else if (action == "order") {
         auto security_id = Get<int64_t>(j[1]);
         auto sub_account = Get<std::string>(j[2]);
@@ -670,7 +760,7 @@ void Connection::OnMessage(const std::string& msg) {
           c.tif = kFillOrKill;
         else if (!strcasecmp(tif_str.c_str(), "GTX"))
           c.tif = kGoodTillCrossing;
-        auto ord = new Order{};
+        auto ord = GlobalOrderBook::Instance().NewOrder();
         (Contract&)* ord = c;
         ord->user = self->user_;
         ExchangeConnectivityManager::Instance().Place(ord);
@@ -727,38 +817,100 @@ void Connection::OnMessage(const std::string& msg) {
         auto tm0 = 0l;
         if (j.size() >= 2) tm0 = Get<int64_t>(j[1]);
         tm0 = std::max(time(nullptr) - 24 * 3600, tm0);
+        // ["pnl", from, interval seconds to downsample to, to]
+        auto interval = 0;
+        if (j.size() >= 3) interval = Get<int>(j[2]);
+        auto tm1 = std::numeric_limits<time_t>::max();
+        if (j.size() >= 4) tm1 = Get<int64_t>(j[3]);
         for (auto& pair : PositionManager::Instance().pnls_) {
           auto id = pair.first;
           auto sub_accounts = self->user_->sub_accounts;
           if (sub_accounts->find(id) == sub_accounts->end()) continue;
-          auto path = fs::path(".") / "store" / ("pnl-" + std::to_string(id));
-          std::ifstream f(path.c_str());
-          const int LINE_LENGTH = 100;
-          char str[LINE_LENGTH];
+          // streamed in chunks so that a long history does not end up in
+          // one huge message
+          static const size_t kChunk = 1000;
           json j2;
-          while (f.getline(str, LINE_LENGTH)) {
-            int tm;
-            double a, b;
-            if (3 == sscanf(str, "%d %lf %lf", &tm, &a, &b)) {
-              if (tm <= tm0) continue;
-              json j = {
-                  tm,
-                  a,
-                  b,
-              };
-              j2.push_back(j);
-            }
-          }
-          if (j2.size()) {
+          auto flush = [&]() {
+            if (j2.empty()) return;
             json j = {
                 "Pnl",
                 id,
                 j2,
             };
             self->Send(j.dump());
-          }
+            j2.clear();
+          };
+          auto& series = PositionManager::Instance().GetPnlSeries(id);
+          series.Query(tm0 + 1, tm1, interval, [&](const PnlRecord& r) {
+            j2.push_back(json{r.tm, r.realized, r.unrealized});
+            if (j2.size() >= kChunk) flush();
+          });
+          flush();
         }
         self->sub_pnl_ = true;
+      } else if (action == "exposure") {
+        self->exposures_.clear();
+        self->sub_exposure_ = true;
+      } else if (action == "what_if") {
+        // ["what_if", sub_account or "" for all, price_shock, e.g. -0.1]
+        auto name = Get<std::string>(j[1]);
+        auto shock = j.size() > 2 ? GetNum(j[2]) : 0.;
+        SubAccount::IdType id = 0;
+        if (!name.empty()) {
+          auto acc = AccountManager::Instance().GetSubAccount(name);
+          auto accs = self->user_->sub_accounts;
+          if (!acc || (!self->user_->is_admin &&
+                       accs->find(acc->id) == accs->end())) {
+            json j = {"error", "what_if", "sub_account",
+                      "Invalid sub_account: " + name};
+            self->Send(j.dump());
+            return;
+          }
+          id = acc->id;
+        } else if (!self->user_->is_admin) {
+          return;
+        }
+        auto book = PositionManager::Instance().GetBook(id);
+        auto totals = book.Compute(shock);
+        json sectors = json::object();
+        for (auto& pair : book.GetSectorExposure(shock))
+          sectors[std::to_string(pair.first)] = pair.second;
+        json j = {
+            "what_if",
+            name,
+            shock,
+            book.size(),
+            totals.unrealized_pnl,
+            totals.gross_exposure,
+            totals.net_exposure,
+            sectors,
+        };
+        self->Send(j.dump());
+      } else if (action == "latency") {
+        // one row per adapter or algo and stage:
+        // ["latency", scope, name, stage, count, p50, p90, p99, p999, max]
+        // in nanoseconds
+        if (!self->user_->is_admin) return;
+        LatencyMonitor::Instance().ForEach(
+            [self](auto scope, auto& name, auto& stats) {
+              for (auto i = 0; i < kNumLatencyStages; ++i) {
+                auto& h = stats.stages[i];
+                if (!h.count()) continue;
+                json j = {
+                    "latency",
+                    scope,
+                    name,
+                    kLatencyStageNames[i],
+                    h.count(),
+                    h.Percentile(0.5),
+                    h.Percentile(0.9),
+                    h.Percentile(0.99),
+                    h.Percentile(0.999),
+                    h.Percentile(1),
+                };
+                self->Send(j.dump());
+              }
+            });
       } else if (action == "sub") {
         json jout = {
             "md",
@@ -816,14 +968,14 @@ void Connection::OnMessage(const std::string& msg) {
   });
 }
 
-void Connection::Send(Confirmation::Ptr cm) {
+void Connection::Send(const Confirmation::Ptr& cm) {
   if (closed_) return;
   if (!user_) return;
   if (user_->sub_accounts->find(cm->order->sub_account->id) ==
       user_->sub_accounts->end())
     return;
   auto self = shared_from_this();
-  strand_.post([self, cm]() { self->Send(*cm.get(), false); });
+  strand_.post([self, cm]() { self->Send(*cm, false); });
 }
 
 void Connection::Send(const Algo& algo, const std::string& status,
@@ -951,10 +1103,10 @@ void Connection::Send(const Confirmation& cm, bool offline) {
       if (!status) status = "cancelled";
       j.push_back(status);
       if (cm.exec_type == kNew) {
-        j.push_back(cm.order_id);
+        j.push_back(cm.order_id.c_str());
       }
       if (!cm.text.empty()) {
-        j.push_back(cm.text);
+        j.push_back(cm.text.c_str());
       }
       break;
 
@@ -965,7 +1117,7 @@ void Connection::Send(const Confirmation& cm, bool offline) {
       j.push_back(status);
       j.push_back(cm.last_shares);
       j.push_back(cm.last_px);
-      j.push_back(cm.exec_id);
+      j.push_back(cm.exec_id.c_str());
       if (cm.exec_trans_type == kTransNew)
         j.push_back("new");
       else if (cm.exec_trans_type == kTransCancel)
@@ -981,7 +1133,7 @@ void Connection::Send(const Confirmation& cm, bool offline) {
     case kRiskRejected:
       if (!status) status = "risk_rejected";
       j.push_back(status);
-      j.push_back(cm.text);
+      j.push_back(cm.text.c_str());
       if (cm.exec_type == kRiskRejected) {
         j.push_back(cm.order->sec->id);
         j.push_back(cm.order->algo_id);
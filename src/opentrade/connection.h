@@ -28,13 +28,14 @@ class Connection : public std::enable_shared_from_this<Connection> {
              std::shared_ptr<boost::asio::io_service> service);
   ~Connection();
   void OnMessage(const std::string&);
-  void Send(Confirmation::Ptr cm);
+  void Send(const Confirmation::Ptr& cm);
   void Send(const Algo& algo, const std::string& status,
             const std::string& body, uint32_t seq);
   void Close() { closed_ = true; }
 
  protected:
   void PublishMarketdata();
+  void PublishExposure();
   void PublishMarketStatus();
   void Send(const std::string& msg) {
     if (!closed_) transport_->Send(msg);
@@ -57,7 +58,9 @@ class Connection : public std::enable_shared_from_this<Connection> {
   boost::unordered_map<std::pair<SubAccount::IdType, Security::IdType>,
                        std::pair<double, double>>
       single_pnls_;
+  std::map<uint64_t, std::pair<double, double>> exposures_;
   bool sub_pnl_ = false;
+  bool sub_exposure_ = false;
   bool closed_ = false;
   friend class Server;
   friend class AlgoManager;
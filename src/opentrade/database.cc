@@ -152,6 +152,13 @@ static const char create_tables_sql[] = R"(
     primary key(id)
   );
   create index if not exists position__index on position(sub_account_id, security_id, id desc);
+
+  -- number of records of each local position WAL replicated into position
+  create table if not exists position_wal(
+    "name" varchar(50) not null,
+    seq int8 not null,
+    primary key("name")
+  );
 )";
 
 void Database::Initialize(const std::string& url, uint8_t pool_size,
@@ -1,33 +1,55 @@
 #include "exchange_connectivity.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "latency.h"
 #include "logger.h"
+#include "mpsc_queue.h"
 #include "risk.h"
+#include "router.h"
+#include "task_pool.h"
 
 namespace opentrade {
 
+static inline void UpdateThrottle(AccountBase* acc, Security::IdType sid,
+                                  int64_t now) {
+  auto& l = acc->limits;
+  if (l.msg_rate > 0) acc->throttle.Update(now, l.msg_rate);
+  if (l.msg_rate_per_security > 0)
+    acc->GetThrottle(sid).Update(now, l.msg_rate_per_security);
+}
+
 static inline void UpdateThrottle(const Order& ord) {
-  auto tm = time(nullptr);
-  const_cast<SubAccount*>(ord.sub_account)->throttle_in_sec.Update(tm);
-  const_cast<BrokerAccount*>(ord.broker_account)->throttle_in_sec.Update(tm);
-  const_cast<User*>(ord.user)->throttle_in_sec.Update(tm);
-  if (ord.sub_account->limits.msg_rate_per_security > 0)
-    const_cast<SubAccount*>(ord.sub_account)
-        ->throttle_per_security_in_sec[ord.sec->id]
-        .Update(tm);
-  if (ord.broker_account->limits.msg_rate_per_security > 0)
-    const_cast<BrokerAccount*>(ord.broker_account)
-        ->throttle_per_security_in_sec[ord.sec->id]
-        .Update(tm);
-  if (ord.user->limits.msg_rate_per_security > 0)
-    const_cast<User*>(ord.user)
-        ->throttle_per_security_in_sec[ord.sec->id]
-        .Update(tm);
+  auto now = NowInNano();
+  auto sid = ord.sec->id;
+  UpdateThrottle(const_cast<SubAccount*>(ord.sub_account), sid, now);
+  UpdateThrottle(const_cast<BrokerAccount*>(ord.broker_account), sid, now);
+  UpdateThrottle(const_cast<User*>(ord.user), sid, now);
+}
+
+// The first confirmation of a new order after it was sent acks it, the ack
+// is stamped once here and shared by the router and the latency monitor.
+static inline void Track(Order* ord, OrderStatus exec_type) {
+  auto& t = ord->times;
+  auto acked = t.send && !t.ack && exec_type != kUnconfirmedNew &&
+               exec_type != kUnconfirmedCancel;
+  if (acked) {
+    t.ack = NowInNano();
+    Router::Instance().OnAck(*ord, exec_type);
+  }
+  LatencyMonitor::Instance().OnConfirmation(ord, exec_type, acked);
 }
 
 static inline void HandleConfirmation(Order* ord, OrderStatus exec_type,
                                       const std::string& text = "",
                                       int64_t tm = 0) {
-  auto cm = std::make_shared<Confirmation>();
+  Track(ord, exec_type);
+  auto cm = Confirmation::New();
   cm->order = ord;
   cm->exec_type = exec_type;
   if (exec_type == kNew)
@@ -44,6 +66,11 @@ static inline void Handle(const std::string& name, Order::IdType id, T desc,
                           int64_t transaction_time) {
   auto ord = GlobalOrderBook::Instance().Get(id);
   if (!ord) {
+    if (GlobalOrderBook::Instance().IsRetired(id)) {
+      LOG_ERROR(name << ": " << desc << " confirmation of retired order: "
+                     << id << ", text=" << text << ", ignored");
+      return;
+    }
     LOG_DEBUG(name << ": Unknown ClOrdId of " << desc << " confirmation: " << id
                    << ", ignored");
     return;
@@ -58,6 +85,11 @@ static inline void Handle(const std::string& name, Order::IdType id,
   if (!orig_id) {
     auto ord = GlobalOrderBook::Instance().Get(id);
     if (!ord) {
+      if (GlobalOrderBook::Instance().IsRetired(id)) {
+        LOG_ERROR(name << ": " << desc << " confirmation of retired order: "
+                       << id << ", text=" << text << ", ignored");
+        return;
+      }
       LOG_DEBUG(name << ": Unknown ClOrdId of " << desc
                      << " confirmation: " << id << ", ignored");
       return;
@@ -74,9 +106,10 @@ static inline void HandleConfirmation(Order* ord, double qty, double price,
                                       const std::string& exec_id, int64_t tm,
                                       bool is_partial,
                                       ExecTransType exec_trans_type) {
-  auto cm = std::make_shared<Confirmation>();
+  auto cm = Confirmation::New();
   cm->order = ord;
   cm->exec_type = is_partial ? kPartiallyFilled : kFilled;
+  Track(ord, cm->exec_type);
   cm->last_shares = qty;
   cm->last_px = price;
   cm->exec_id = exec_id;
@@ -104,9 +137,252 @@ static inline bool CheckAdapter(ExchangeConnectivityAdapter* adapter,
   return true;
 }
 
-bool ExchangeConnectivityManager::Place(Order* ord) {
-  assert(ord->qty > 0);
+// Outbound queue of a sub account with msg_queue_ms. Orders which would
+// breach message rate are held and sent as soon as rate allows, cancels
+// before new orders, and new orders in arrival order. A new order canceled
+// while still held is dropped without anything sent, one held longer than
+// msg_queue_ms is risk rejected.
+struct ExchangeConnectivityManager::Pacer {
+  std::mutex m;
+  std::deque<Order*> cancels;
+  std::deque<std::pair<Order*, int64_t>> news;  // with NowInNano() held
+  bool scheduled = false;
+};
+
+static TaskPool kPacingTaskPool;
+
+ExchangeConnectivityManager::Pacer* ExchangeConnectivityManager::GetPacer(
+    const SubAccount& acc) {
+  auto it = pacers_.find(acc.id);
+  if (it != pacers_.end()) return it->second;
+  auto pacer = new Pacer;
+  auto res = pacers_.emplace(acc.id, pacer);
+  if (!res.second) delete pacer;
+  return res.first->second;
+}
+
+bool ExchangeConnectivityManager::Hold(Pacer* pacer, Order* ord,
+                                       bool is_cancel) {
+  std::lock_guard<std::mutex> lock(pacer->m);
+  if (!pacer->scheduled && pacer->cancels.empty() && pacer->news.empty() &&
+      !RiskManager::Instance().GetMsgRateWait(*ord, NowInNano()))
+    return false;
+  if (is_cancel)
+    pacer->cancels.push_back(ord);
+  else
+    pacer->news.emplace_back(ord, NowInNano());
+  if (!pacer->scheduled) {
+    pacer->scheduled = true;
+    kPacingTaskPool.AddTask([this, pacer]() { Drain(pacer); });
+  }
+  return true;
+}
+
+bool ExchangeConnectivityManager::Unhold(Pacer* pacer, const Order& ord) {
+  std::lock_guard<std::mutex> lock(pacer->m);
+  for (auto it = pacer->news.begin(); it != pacer->news.end(); ++it) {
+    if (it->first == &ord) {
+      pacer->news.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Due orders are popped and charged to the message rate under the lock, and
+// confirmed or sent after releasing it, so that Hold and Unhold never wait
+// on the adapter. scheduled stays set meanwhile, which makes Hold queue new
+// orders behind those popped.
+void ExchangeConnectivityManager::Drain(Pacer* pacer) {
+  std::vector<std::pair<Order*, bool>> due;  // with is_cancel
+  std::vector<Order*> expired;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(pacer->m);
+      int64_t wait = 0;
+      while (!pacer->cancels.empty() || !pacer->news.empty()) {
+        auto now = NowInNano();
+        auto is_cancel = !pacer->cancels.empty();
+        auto ord =
+            is_cancel ? pacer->cancels.front() : pacer->news.front().first;
+        if (!is_cancel) {
+          auto max_delay = ord->sub_account->limits.msg_queue_ms * 1000000;
+          if (now - pacer->news.front().second > max_delay) {
+            pacer->news.pop_front();
+            expired.push_back(ord);
+            continue;
+          }
+        }
+        wait = RiskManager::Instance().GetMsgRateWait(*ord, now);
+        if (wait > 0) break;
+        if (is_cancel)
+          pacer->cancels.pop_front();
+        else
+          pacer->news.pop_front();
+        UpdateThrottle(*ord);
+        due.emplace_back(ord, is_cancel);
+      }
+      if (due.empty() && expired.empty()) {
+        if (wait > 0)
+          kPacingTaskPool.AddTask(
+              [this, pacer]() { Drain(pacer); },
+              boost::posix_time::microseconds(wait / 1000 + 1));
+        else
+          pacer->scheduled = false;
+        return;
+      }
+    }
+    for (auto ord : expired)
+      HandleConfirmation(ord, kRiskRejected,
+                         "Held longer than msg_queue_ms by message rate");
+    for (auto& pair : due) Send(pair.first, pair.second);
+    expired.clear();
+    due.clear();
+  }
+}
+
+void ExchangeConnectivityManager::Send(Order* ord, bool is_cancel) {
   kRiskError.clear();
+  if (is_cancel) {
+    auto orig_ord = GlobalOrderBook::Instance().Get(ord->orig_id);
+    if (!orig_ord || !orig_ord->IsLive()) {
+      HandleConfirmation(ord, kRiskRejected, "Order is not live any more");
+      return;
+    }
+  }
+  auto adapter = ord->broker_account->adapter;
+  if (!CheckAdapter(adapter, ord->broker_account->adapter_name)) {
+    HandleConfirmation(ord, kRiskRejected, kRiskError);
+    return;
+  }
+  // charged to the message rate by Drain already
+  Enqueue(ord, is_cancel);
+}
+
+// Outbound pipeline of an adapter. Place and Cancel only push onto a lock-free
+// queue, a sender thread per adapter drains it in batches, calls the adapter
+// for each order and then Flush, so that algo and io threads never wait on
+// the network or on the adapter's session lock. The thread spins for
+// sender_spin_us (adapter config, default 0, i.e. sleeps right away) after the
+// last order before sleeping, and is pinned to sender_cpu if configured, a
+// comma separated list with one cpu per lane if the adapter routes over
+// several. Stop() sends what is queued and joins the threads.
+struct ExchangeConnectivityManager::Gateway {
+  struct Item {
+    Order* ord;
+    bool is_cancel;
+  };
+  static constexpr int kMaxBatch = 64;
+
+  explicit Gateway(ExchangeConnectivityAdapter* adapter) : adapter(adapter) {}
+  void Push(Order* ord, bool is_cancel);
+  void Run(int cpu, int64_t spin_ns);
+
+  ExchangeConnectivityAdapter* adapter;
+  MpscQueue<Item> queue;
+  std::atomic<bool> sleeping = false;
+  std::atomic<bool> stopping = false;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread thread;
+};
+
+void ExchangeConnectivityManager::Gateway::Push(Order* ord, bool is_cancel) {
+  queue.Push(Item{ord, is_cancel});
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(m);
+    cv.notify_one();
+  }
+}
+
+void ExchangeConnectivityManager::Gateway::Run(int cpu, int64_t spin_ns) {
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+      LOG_WARN(adapter->name() << ": Failed to pin sender thread to cpu "
+                               << cpu);
+  }
+  auto idle_since = NowInNano();
+  Item item;
+  while (true) {
+    auto n = 0;
+    for (; n < kMaxBatch && queue.TryPop(&item); ++n) {
+      if (!item.is_cancel) {
+        item.ord->times.send = NowInNano();
+        Router::Instance().OnSent(*item.ord);
+      }
+      auto err = item.is_cancel ? adapter->Cancel(*item.ord)
+                                : adapter->Place(*item.ord);
+      if (!err.empty()) HandleConfirmation(item.ord, kRiskRejected, err);
+    }
+    if (n) {
+      adapter->Flush();
+      idle_since = NowInNano();
+      continue;
+    }
+    if (stopping.load(std::memory_order_acquire)) break;
+    if (NowInNano() - idle_since < spin_ns) continue;
+    std::unique_lock<std::mutex> lock(m);
+    sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (queue.empty()) cv.wait_for(lock, std::chrono::milliseconds(1));
+    sleeping = false;
+  }
+}
+
+ExchangeConnectivityManager::Gateway* ExchangeConnectivityManager::GetGateway(
+    ExchangeConnectivityAdapter* adapter, size_t lane) {
+  auto key = std::make_pair(adapter, lane);
+  auto it = gateways_.find(key);
+  if (it != gateways_.end()) return it->second;
+  auto gateway = new Gateway(adapter);
+  auto res = gateways_.emplace(key, gateway);
+  if (!res.second) {
+    delete gateway;
+    return res.first->second;
+  }
+  auto cpus = Split(adapter->config("sender_cpu"), ",");
+  auto cpu = lane < cpus.size() ? atoi(cpus[lane].c_str()) : -1;
+  int64_t spin_ns = atol(adapter->config("sender_spin_us").c_str()) * 1000;
+  std::lock_guard<std::mutex> lock(gateway->m);
+  gateway->thread =
+      std::thread([gateway, cpu, spin_ns]() { gateway->Run(cpu, spin_ns); });
+  return gateway;
+}
+
+void ExchangeConnectivityManager::Stop() {
+  stopped_ = true;
+  for (auto& pair : gateways_) {
+    auto gateway = pair.second;
+    // the thread is started right after the gateway is inserted
+    for (auto started = false; !started;) {
+      std::lock_guard<std::mutex> lock(gateway->m);
+      gateway->stopping = true;
+      gateway->cv.notify_one();
+      started = gateway->thread.joinable();
+    }
+    gateway->thread.join();
+    // pushed by a racing Enqueue after the thread's last pop
+    Gateway::Item item;
+    while (gateway->queue.TryPop(&item))
+      HandleConfirmation(item.ord, kRiskRejected, "Shutting down");
+  }
+}
+
+void ExchangeConnectivityManager::Enqueue(Order* ord, bool is_cancel) {
+  if (stopped_) {
+    HandleConfirmation(ord, kRiskRejected, "Shutting down");
+    return;
+  }
+  auto adapter = ord->broker_account->adapter;
+  GetGateway(adapter, adapter->Route(*ord))->Push(ord, is_cancel);
+}
+
+bool ExchangeConnectivityManager::Prepare(Order* ord) {
+  assert(ord->qty > 0);
   assert(ord->sub_account);
   assert(ord->sec);
   assert(ord->user);
@@ -119,7 +395,6 @@ bool ExchangeConnectivityManager::Place(Order* ord) {
     snprintf(buf, sizeof(buf), "Not permissioned to trade with sub account: %s",
              ord->sub_account->name);
     kRiskError = buf;
-    HandleConfirmation(ord, kRiskRejected, kRiskError);
     return false;
   }
   auto brokers = ord->sub_account->broker_accounts;
@@ -133,56 +408,119 @@ bool ExchangeConnectivityManager::Place(Order* ord) {
     snprintf(buf, sizeof(buf), "Not permissioned to trade on exchange: %s",
              exchange->name);
     kRiskError = buf;
-    HandleConfirmation(ord, kRiskRejected, kRiskError);
     return false;
   }
   ord->broker_account = it->second;
-  if (ord->type == kOTC) {
-    ord->id = GlobalOrderBook::Instance().NewOrderId();
-    ord->leaves_qty = ord->qty;
-    HandleConfirmation(ord, kUnconfirmedNew);
-    HandleConfirmation(ord, ord->qty, ord->price,
-                       "OTC-" + std::to_string(ord->id), NowUtcInMicro(), false,
-                       kTransNew);
-    return true;
-  }
+  if (ord->type == kOTC) return true;
+  ord->broker_account = Router::Instance().Route(it->second);
   auto adapter = ord->broker_account->adapter;
   auto name = ord->broker_account->adapter_name;
-  if (!CheckAdapter(adapter, name)) {
-    HandleConfirmation(ord, kRiskRejected, kRiskError);
-    return false;
-  }
+  if (!CheckAdapter(adapter, name)) return false;
   if (ord->type == kMarket || ord->type == kStop) {
     if (ord->price <= 0) {
       ord->price = ord->sec->CurrentPrice();
       if (ord->price <= 0) {
         kRiskError = "Can not find last price for this security";
-        HandleConfirmation(ord, kRiskRejected, kRiskError);
         return false;
       }
     }
   } else if (ord->price <= 0) {
     kRiskError = "Price can not be empty for limit order";
-    HandleConfirmation(ord, kRiskRejected, kRiskError);
-    return false;
-  }
-  if (!RiskManager::Instance().Check(*ord)) {
-    HandleConfirmation(ord, kRiskRejected, kRiskError);
     return false;
   }
+  return true;
+}
+
+void ExchangeConnectivityManager::PlaceOtc(Order* ord) {
+  ord->id = GlobalOrderBook::Instance().NewOrderId();
+  ord->leaves_qty = ord->qty;
+  HandleConfirmation(ord, kUnconfirmedNew);
+  HandleConfirmation(ord, ord->qty, ord->price,
+                     "OTC-" + std::to_string(ord->id), NowUtcInMicro(), false,
+                     kTransNew);
+}
+
+bool ExchangeConnectivityManager::Submit(Order* ord, Pacer* pacer) {
+  ord->times.risk = NowInNano();
   ord->leaves_qty = ord->qty;
   ord->id = GlobalOrderBook::Instance().NewOrderId();
   ord->tm = NowUtcInMicro();
   HandleConfirmation(ord, kUnconfirmedNew, "", ord->tm);
-  kRiskError = adapter->Place(*ord);
-  auto ok = kRiskError.empty();
-  if (!ok)
+  if (pacer && Hold(pacer, ord, false)) return true;
+  Enqueue(ord, false);
+  UpdateThrottle(*ord);
+  return true;
+}
+
+bool ExchangeConnectivityManager::Place(Order* ord) {
+  ord->times.place = NowInNano();
+  kRiskError.clear();
+  if (!Prepare(ord)) {
+    if (ord->sub_account && ord->sec && ord->user)
+      HandleConfirmation(ord, kRiskRejected, kRiskError);
+    return false;
+  }
+  if (ord->type == kOTC) {
+    PlaceOtc(ord);
+    return true;
+  }
+  Pacer* pacer = nullptr;
+  if (ord->sub_account->limits.msg_queue_ms > 0)
+    pacer = GetPacer(*ord->sub_account);
+  Reservations reservations;
+  if (!RiskManager::Instance().Check(*ord, !pacer, &reservations)) {
     HandleConfirmation(ord, kRiskRejected, kRiskError);
-  else
-    UpdateThrottle(*ord);
+    return false;
+  }
+  auto ok = Submit(ord, pacer);
+  RiskManager::Settle(&reservations);
   return ok;
 }
 
+size_t ExchangeConnectivityManager::PlaceBatch(const std::vector<Order*>& ords,
+                                               bool all_or_none) {
+  auto n = ords.size();
+  auto now = NowInNano();
+  for (auto ord : ords) ord->times.place = now;
+  std::vector<std::string> errors(n);
+  Reservations reservations;
+  std::string first_error;
+  for (auto i = 0u; i < n; ++i) {
+    kRiskError.clear();
+    if (Prepare(ords[i])) continue;
+    errors[i] = kRiskError.empty() ? "Invalid order" : kRiskError;
+    if (first_error.empty()) first_error = errors[i];
+  }
+  if (all_or_none && !first_error.empty()) {
+    for (auto& err : errors) {
+      if (err.empty()) err = "Basket rejected: " + first_error;
+    }
+  } else {
+    RiskManager::Instance().CheckBatch(ords, &errors, all_or_none,
+                                       &reservations);
+  }
+  size_t nplaced = 0;
+  for (auto i = 0u; i < n; ++i) {
+    auto ord = ords[i];
+    if (!errors[i].empty()) {
+      if (ord->sub_account && ord->sec && ord->user)
+        HandleConfirmation(ord, kRiskRejected, errors[i]);
+      continue;
+    }
+    if (ord->type == kOTC) {
+      PlaceOtc(ord);
+      nplaced++;
+      continue;
+    }
+    Pacer* pacer = nullptr;
+    if (ord->sub_account->limits.msg_queue_ms > 0)
+      pacer = GetPacer(*ord->sub_account);
+    if (Submit(ord, pacer)) nplaced++;
+  }
+  RiskManager::Settle(&reservations);
+  return nplaced;
+}
+
 bool ExchangeConnectivityManager::Cancel(const Order& orig_ord) {
   kRiskError.clear();
   assert(orig_ord.sub_account);
@@ -194,26 +532,36 @@ bool ExchangeConnectivityManager::Cancel(const Order& orig_ord) {
   if (!orig_ord.sec) return false;
   if (!orig_ord.user) return false;
   if (!orig_ord.broker_account) return false;
+  Pacer* pacer = nullptr;
+  if (orig_ord.sub_account->limits.msg_queue_ms > 0) {
+    pacer = GetPacer(*orig_ord.sub_account);
+    if (Unhold(pacer, orig_ord)) {
+      HandleConfirmation(const_cast<Order*>(&orig_ord), kCanceled,
+                         "Canceled before sent");
+      return true;
+    }
+  }
   auto adapter = orig_ord.broker_account->adapter;
   auto name = orig_ord.broker_account->adapter_name;
-  auto cancel_order = new Order(orig_ord);
+  auto cancel_order = GlobalOrderBook::Instance().NewOrder(orig_ord);
+  // unnumbered until sent, it must never carry the original order's id
+  // into the order book
+  cancel_order->id = 0;
   cancel_order->orig_id = orig_ord.id;
   cancel_order->status = kUnconfirmedCancel;
   cancel_order->tm = NowUtcInMicro();
+  cancel_order->times = {};
   if (!CheckAdapter(adapter, name) ||
-      !RiskManager::Instance().CheckMsgRate(orig_ord)) {
+      (!pacer && !RiskManager::Instance().CheckMsgRate(orig_ord))) {
     HandleConfirmation(cancel_order, kRiskRejected, kRiskError);
     return false;
   }
-  HandleConfirmation(cancel_order, kUnconfirmedCancel, "", cancel_order->tm);
   cancel_order->id = GlobalOrderBook::Instance().NewOrderId();
-  kRiskError = adapter->Cancel(*cancel_order);
-  auto ok = kRiskError.empty();
-  if (!ok)
-    HandleConfirmation(cancel_order, kRiskRejected, kRiskError);
-  else
-    UpdateThrottle(orig_ord);
-  return ok;
+  HandleConfirmation(cancel_order, kUnconfirmedCancel, "", cancel_order->tm);
+  if (pacer && Hold(pacer, cancel_order, true)) return true;
+  Enqueue(cancel_order, true);
+  UpdateThrottle(orig_ord);
+  return true;
 }
 
 void ExchangeConnectivityAdapter::HandleNew(Order::IdType id,
@@ -231,16 +579,24 @@ void ExchangeConnectivityAdapter::HandlePendingNew(Order::IdType id,
 void ExchangeConnectivityAdapter::HandleFill(
     Order::IdType id, double qty, double price, const std::string& exec_id,
     int64_t transaction_time, bool is_partial, ExecTransType exec_trans_type) {
-  if (GlobalOrderBook::Instance().IsDupExecId(exec_id)) {
-    LOG_DEBUG(name() << ": Duplicate exec id: " << exec_id << ", ignored");
-    return;
-  }
   auto ord = GlobalOrderBook::Instance().Get(id);
   if (!ord) {
+    if (GlobalOrderBook::Instance().IsRetired(id)) {
+      // e.g. a late bust or correction, needs to be booked manually
+      LOG_ERROR(name() << ": Fill confirmation of retired order: " << id
+                       << ", qty=" << qty << ", price=" << price
+                       << ", exec_id=" << exec_id << ", exec_trans_type="
+                       << static_cast<char>(exec_trans_type) << ", ignored");
+      return;
+    }
     LOG_DEBUG(name() << ": Unknown ClOrdId of fill confirmation: " << id
                      << ", ignored");
     return;
   }
+  if (GlobalOrderBook::Instance().IsDupExecId(exec_id, *ord)) {
+    LOG_DEBUG(name() << ": Duplicate exec id: " << exec_id << ", ignored");
+    return;
+  }
   if (qty <= 0 || price <= 0) {
     LOG_DEBUG(name() << ": Invalid fill confirmation: " << id << ", qty=" << qty
                      << ", price=" << price << ", ignored");
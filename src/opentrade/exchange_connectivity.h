@@ -1,16 +1,29 @@
 #ifndef OPENTRADE_EXCHANGE_CONNECTIVITY_H_
 #define OPENTRADE_EXCHANGE_CONNECTIVITY_H_
 
+#include <tbb/concurrent_unordered_map.h>
+#include <vector>
+
+#include "account.h"
 #include "adapter.h"
 #include "order.h"
 #include "utility.h"
 
 namespace opentrade {
 
+struct LatencyStats;
+
 class ExchangeConnectivityAdapter : public virtual NetworkAdapter {
  public:
   virtual std::string Place(const Order& ord) noexcept = 0;
   virtual std::string Cancel(const Order& ord) noexcept = 0;
+  // called by the sender thread after each batch of Place/Cancel, adapters
+  // buffering their writes send them out here
+  virtual void Flush() noexcept {}
+  // outbound lane of ord, each lane has its own sender thread, called on the
+  // placing thread right before ord is queued, e.g. to spread orders over
+  // several sessions
+  virtual size_t Route(const Order& ord) noexcept { return 0; }
   void HandleNew(Order::IdType id, const std::string& order_id,
                  int64_t transaction_time = 0);
   void HandlePendingNew(Order::IdType id, const std::string& text,
@@ -30,6 +43,10 @@ class ExchangeConnectivityAdapter : public virtual NetworkAdapter {
                             int64_t transaction_time = 0);
   void HandleOthers(Order::IdType id, OrderStatus exec_type,
                     const std::string& text, int64_t transaction_time = 0);
+
+ private:
+  mutable std::atomic<LatencyStats*> latency_stats_ = nullptr;
+  friend class LatencyMonitor;
 };
 
 class ExchangeConnectivityManager
@@ -37,7 +54,41 @@ class ExchangeConnectivityManager
       public Singleton<ExchangeConnectivityManager> {
  public:
   bool Place(Order* ord);
+  // place a basket with one pass of risk check, see RiskManager::CheckBatch,
+  // failed orders are risk rejected, returns the number of orders placed
+  size_t PlaceBatch(const std::vector<Order*>& ords, bool all_or_none = false);
   bool Cancel(const Order& orig_ord);
+  // send the orders queued to the adapters, join the sender threads, orders
+  // placed afterwards are risk rejected
+  void Stop();
+
+ private:
+  struct Pacer;
+  struct Gateway;
+  // validate and route, false with kRiskError set if rejected
+  bool Prepare(Order* ord);
+  void PlaceOtc(Order* ord);
+  // number the order and send it, or hold it if paced
+  bool Submit(Order* ord, Pacer* pacer);
+  Pacer* GetPacer(const SubAccount& acc);
+  // queue ord if message rate or earlier queued orders do not allow sending
+  // it now
+  bool Hold(Pacer* pacer, Order* ord, bool is_cancel);
+  // remove a queued new order, true if found
+  bool Unhold(Pacer* pacer, const Order& ord);
+  void Drain(Pacer* pacer);
+  void Send(Order* ord, bool is_cancel);
+  Gateway* GetGateway(ExchangeConnectivityAdapter* adapter, size_t lane);
+  // hand ord over to the sender thread of its adapter, rejection is
+  // confirmed asynchronously
+  void Enqueue(Order* ord, bool is_cancel);
+
+ private:
+  tbb::concurrent_unordered_map<SubAccount::IdType, Pacer*> pacers_;
+  tbb::concurrent_unordered_map<
+      std::pair<ExchangeConnectivityAdapter*, size_t>, Gateway*>
+      gateways_;
+  std::atomic<bool> stopped_ = false;
 };
 
 }  // namespace opentrade
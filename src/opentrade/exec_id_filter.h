@@ -0,0 +1,97 @@
+#ifndef OPENTRADE_EXEC_ID_FILTER_H_
+#define OPENTRADE_EXEC_ID_FILTER_H_
+
+#include <tbb/spin_mutex.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+namespace opentrade {
+
+// Duplicate exec id detection in fixed memory. Only 64-bit fingerprints of
+// (scope, exec id) are kept, in two open-addressing generations of
+// `capacity` slots each. Once the current generation is half full, the older
+// one is wiped and takes over, so at least the latest capacity / 2 exec ids
+// are always remembered.
+class ExecIdFilter {
+ public:
+  explicit ExecIdFilter(size_t capacity = 1 << 20) { Reset(capacity); }
+
+  // returns true if seen before, otherwise remembers it
+  bool IsDup(std::string_view exec_id, uint64_t scope = 0) {
+    auto fp = Fingerprint(exec_id, scope);
+    tbb::spin_mutex::scoped_lock lock(m_);
+    if (Find(old_, fp)) return true;
+    auto slot = Probe(cur_, fp);
+    if (*slot == fp) return true;
+    *slot = fp;
+    if (++size_ > mask_ / 2) {
+      std::swap(cur_, old_);
+      memset(cur_, 0, (mask_ + 1) * sizeof(*cur_));
+      size_ = 0;
+    }
+    return false;
+  }
+
+  // forget everything, e.g. on session rollover
+  void Clear() {
+    tbb::spin_mutex::scoped_lock lock(m_);
+    memset(slots_.get(), 0, 2 * (mask_ + 1) * sizeof(*cur_));
+    size_ = 0;
+  }
+
+  void Reset(size_t capacity) {
+    size_t n = 1024;
+    while (n < capacity) n <<= 1;
+    tbb::spin_mutex::scoped_lock lock(m_);
+    slots_.reset(new uint64_t[2 * n]());
+    cur_ = slots_.get();
+    old_ = cur_ + n;
+    mask_ = n - 1;
+    size_ = 0;
+  }
+
+  static uint64_t Hash(const char* str, size_t n, uint64_t seed = 0) {
+    // FNV-1a with splitmix64 finalizer
+    uint64_t h = 14695981039346656037ull ^ seed;
+    for (auto i = 0u; i < n; ++i) {
+      h ^= static_cast<unsigned char>(str[i]);
+      h *= 1099511628211ull;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+  }
+
+ private:
+  static uint64_t Fingerprint(std::string_view exec_id, uint64_t scope) {
+    auto fp = Hash(exec_id.data(), exec_id.size(), scope);
+    return fp ? fp : 1;  // 0 marks empty slot
+  }
+
+  uint64_t* Probe(uint64_t* table, uint64_t fp) const {
+    auto i = fp & mask_;
+    while (table[i] && table[i] != fp) i = (i + 1) & mask_;
+    return table + i;
+  }
+
+  bool Find(uint64_t* table, uint64_t fp) const {
+    return *Probe(table, fp) == fp;
+  }
+
+ private:
+  tbb::spin_mutex m_;
+  std::unique_ptr<uint64_t[]> slots_;
+  uint64_t* cur_ = nullptr;
+  uint64_t* old_ = nullptr;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_EXEC_ID_FILTER_H_
@@ -0,0 +1,77 @@
+#include "latency.h"
+
+#include "account.h"
+#include "algo.h"
+#include "exchange_connectivity.h"
+
+namespace opentrade {
+
+int64_t LatencyHistogram::Percentile(double p) const {
+  auto n = count();
+  if (!n) return 0;
+  uint64_t rank = p * n;
+  if (rank >= n) rank = n - 1;
+  uint64_t sum = 0;
+  for (auto i = 0; i < kNumBuckets; ++i) {
+    sum += counts_[i].load(std::memory_order_relaxed);
+    if (sum > rank) return UpperBound(i);
+  }
+  return UpperBound(kNumBuckets - 1);
+}
+
+LatencyStats* LatencyMonitor::GetStats(StatsMap* map,
+                                       const std::string& name) {
+  auto it = map->find(name);
+  if (it != map->end()) return it->second;
+  auto stats = new LatencyStats;
+  auto res = map->emplace(name, stats);
+  if (!res.second) delete stats;
+  return res.first->second;
+}
+
+template <typename T>
+LatencyStats* LatencyMonitor::GetStats(StatsMap* map, const T& owner) {
+  auto stats = owner.latency_stats_.load(std::memory_order_acquire);
+  if (stats) return stats;
+  stats = GetStats(map, owner.name());
+  owner.latency_stats_.store(stats, std::memory_order_release);
+  return stats;
+}
+
+static inline void Record(LatencyStats* stats, LatencyStage stage,
+                          int64_t from, int64_t to) {
+  if (from && to >= from) stats->stages[stage].Record(to - from);
+}
+
+void LatencyMonitor::OnConfirmation(Order* ord, OrderStatus exec_type,
+                                    bool acked) {
+  // rejected by us after sent, e.g. the adapter failed to send
+  if (exec_type == kRiskRejected) return;
+  auto& t = ord->times;
+  if (!t.send) return;  // not a new order sent by us
+  auto is_fill = exec_type == kPartiallyFilled || exec_type == kFilled;
+  if (!acked && (!is_fill || t.fill)) return;
+  LatencyStats* stats[2] = {
+      GetStats(&adapters_, *ord->broker_account->adapter),
+      ord->inst ? GetStats(&algos_, ord->inst->algo()) : nullptr};
+  if (acked) {
+    for (auto s : stats) {
+      if (!s) continue;
+      Record(s, kTickToDispatch, t.tick, t.dispatch);
+      Record(s, kDispatchToPlace, t.dispatch, t.place);
+      Record(s, kPlaceToRisk, t.place, t.risk);
+      Record(s, kRiskToSend, t.risk, t.send);
+      Record(s, kSendToAck, t.send, t.ack);
+      Record(s, kTickToSend, t.tick, t.send);
+      Record(s, kPlaceToAck, t.place, t.ack);
+    }
+  }
+  if (is_fill && !t.fill) {
+    t.fill = acked ? t.ack : NowInNano();
+    for (auto s : stats) {
+      if (s) Record(s, kSendToFill, t.send, t.fill);
+    }
+  }
+}
+
+}  // namespace opentrade
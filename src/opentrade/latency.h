@@ -0,0 +1,98 @@
+#ifndef OPENTRADE_LATENCY_H_
+#define OPENTRADE_LATENCY_H_
+
+#include <tbb/concurrent_unordered_map.h>
+#include <atomic>
+#include <string>
+
+#include "order.h"
+#include "utility.h"
+
+namespace opentrade {
+
+// Histogram of nanoseconds with 8 linear sub-buckets per power of two, i.e.
+// percentiles within 12.5%, recording is two relaxed atomic increments.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBits = 3;
+  static constexpr int kNumBuckets = (64 - kSubBits) << kSubBits;
+
+  void Record(int64_t ns) {
+    if (ns < 0) ns = 0;
+    counts_[Index(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  // upper bound of the bucket holding percentile p (0 - 1), 0 if empty
+  int64_t Percentile(double p) const;
+
+ private:
+  static int Index(uint64_t v) {
+    if (v < (1u << kSubBits)) return v;
+    auto e = 63 - __builtin_clzll(v);
+    auto sub = (v >> (e - kSubBits)) & ((1u << kSubBits) - 1);
+    return ((e - kSubBits + 1) << kSubBits) + sub;
+  }
+  static int64_t UpperBound(int i) {
+    if (i < (1 << kSubBits)) return i;
+    auto shift = (i >> kSubBits) - 1;
+    auto sub = i & ((1 << kSubBits) - 1);
+    return (((1ll << kSubBits) + sub + 1) << shift) - 1;
+  }
+
+ private:
+  std::atomic<uint64_t> counts_[kNumBuckets] = {};
+  std::atomic<uint64_t> count_ = 0;
+};
+
+enum LatencyStage {
+  kTickToDispatch,   // market data update to algo callback
+  kDispatchToPlace,  // algo logic
+  kPlaceToRisk,      // validation and risk check
+  kRiskToSend,       // pacing and the adapter's outbound queue
+  kSendToAck,        // adapter, wire and venue
+  kSendToFill,
+  kTickToSend,       // tick to trade
+  kPlaceToAck,       // order to ack
+  kNumLatencyStages,
+};
+
+static const char* const kLatencyStageNames[kNumLatencyStages] = {
+    "tick_to_dispatch", "dispatch_to_place", "place_to_risk", "risk_to_send",
+    "send_to_ack",      "send_to_fill",      "tick_to_send",  "place_to_ack",
+};
+
+struct LatencyStats {
+  LatencyHistogram stages[kNumLatencyStages];
+};
+
+// Breakdown of new orders' internal latency from the stamps in
+// Order::times, aggregated per adapter and per algo once an order is acked
+// and filled.
+class LatencyMonitor : public Singleton<LatencyMonitor> {
+ public:
+  // records the stages completed by the ack if acked, i.e. ord->times.ack
+  // was just stamped, and stamps the first fill
+  void OnConfirmation(Order* ord, OrderStatus exec_type, bool acked);
+  // func(scope, name, stats), scope is "adapter" or "algo"
+  template <typename Func>
+  void ForEach(Func func) const {
+    for (auto& pair : adapters_) func("adapter", pair.first, *pair.second);
+    for (auto& pair : algos_) func("algo", pair.first, *pair.second);
+  }
+
+ private:
+  typedef tbb::concurrent_unordered_map<std::string, LatencyStats*> StatsMap;
+  static LatencyStats* GetStats(StatsMap* map, const std::string& name);
+  // stats of an adapter or algo, looked up by name once and cached on it
+  template <typename T>
+  static LatencyStats* GetStats(StatsMap* map, const T& owner);
+
+ private:
+  StatsMap adapters_;
+  StatsMap algos_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_LATENCY_H_
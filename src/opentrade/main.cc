@@ -13,6 +13,7 @@
 #include "logger.h"
 #include "market_data.h"
 #include "position.h"
+#include "risk.h"
 #include "security.h"
 #include "server.h"
 
@@ -29,6 +30,13 @@ int main(int argc, char *argv[]) {
   std::string db_url;
   uint16_t db_pool_size;
   bool disable_rms;
+  std::string eod_time;
+  size_t exec_id_window;
+  bool exec_id_per_adapter;
+  int position_flush_ms;
+  size_t position_batch_size;
+  int pnl_publish_ms;
+  double price_band_pct;
   bool db_create_tables;
   int io_threads;
   int algo_threads;
@@ -55,7 +63,28 @@ int main(int argc, char *argv[]) {
         "algo_threads", bpo::value<int>(&algo_threads)->default_value(1),
         "number of algo threads")(
         "disable_rms", bpo::value<bool>(&disable_rms)->default_value(false),
-        "whether disable rms");
+        "whether disable rms")(
+        "eod_time", bpo::value<std::string>(&eod_time),
+        "local end-of-day time (HH:MM:SS) to retire terminal orders")(
+        "exec_id_window",
+        bpo::value<size_t>(&exec_id_window)->default_value(1 << 20),
+        "number of exec ids remembered for duplicate detection")(
+        "exec_id_per_adapter",
+        bpo::value<bool>(&exec_id_per_adapter)->default_value(false),
+        "whether exec ids are only unique within one adapter")(
+        "position_flush_ms",
+        bpo::value<int>(&position_flush_ms)->default_value(100),
+        "max milliseconds a position row waits before written to database")(
+        "position_batch_size",
+        bpo::value<size_t>(&position_batch_size)->default_value(1000),
+        "number of pending position rows to trigger database write")(
+        "pnl_publish_ms",
+        bpo::value<int>(&pnl_publish_ms)->default_value(1000),
+        "interval in milliseconds to record account pnl")(
+        "price_band_pct",
+        bpo::value<double>(&price_band_pct)->default_value(0),
+        "reject limit orders priced further than this fraction from the mid "
+        "or last price, or off tick, 0 to disable");
 
     bpo::options_description config_file_options;
     config_file_options.add(config);
@@ -139,9 +168,21 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  opentrade::RiskManager::Instance().set_price_band_pct(price_band_pct);
   opentrade::AccountManager::Initialize();
-  PositionManager::Initialize();
+  PositionManager::Initialize(position_flush_ms, position_batch_size);
+  opentrade::GlobalOrderBook::Instance().SetExecIdDedup(exec_id_window,
+                                                       exec_id_per_adapter);
   opentrade::GlobalOrderBook::Initialize();
+  if (!eod_time.empty()) {
+    int h = 0, m = 0, s = 0;
+    if (sscanf(eod_time.c_str(), "%d:%d:%d", &h, &m, &s) < 2) {
+      LOG_ERROR("Invalid eod_time: " << eod_time);
+      return 1;
+    }
+    opentrade::GlobalOrderBook::Instance().ScheduleRetire(h * 3600 + m * 60 +
+                                                          s);
+  }
   for (auto &p : MarketDataManager::Instance().adapters()) {
     p.second->Start();
   }
@@ -152,7 +193,7 @@ int main(int argc, char *argv[]) {
     p.second->Start();
   }
 
-  PositionManager::Instance().UpdatePnl();
+  PositionManager::Instance().PublishPnl(pnl_publish_ms);
   AlgoManager::Instance().Run(algo_threads);
   opentrade::Server::Start(port, io_threads);
 
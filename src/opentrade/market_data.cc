@@ -2,6 +2,8 @@
 
 #include "algo.h"
 #include "logger.h"
+#include "position.h"
+#include "risk.h"
 #include "utility.h"
 
 namespace opentrade {
@@ -72,8 +74,11 @@ void MarketDataManager::Add(MarketDataAdapter* adapter) {
 void MarketDataAdapter::Update(Security::IdType id, const MarketData::Quote& q,
                                uint32_t level) {
   if (level >= 5) return;
-  (*md_)[id].depth[level] = q;
+  auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
+  md.depth[level] = q;
   if (level) return;
+  if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -82,7 +87,9 @@ void MarketDataAdapter::Update(Security::IdType id, const MarketData::Quote& q,
 void MarketDataAdapter::Update(Security::IdType id, double price, double size,
                                bool is_bid, uint32_t level) {
   if (level >= 5) return;
-  auto& q = (*md_)[id].depth[level];
+  auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
+  auto& q = md.depth[level];
   if (is_bid) {
     q.bid_price = price;
     q.bid_size = size;
@@ -91,6 +98,7 @@ void MarketDataAdapter::Update(Security::IdType id, double price, double size,
     q.ask_size = size;
   }
   if (level) return;
+  if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -112,10 +120,15 @@ static inline void UpdateVolume(double qty, MarketData::Trade* t) {
 void MarketDataAdapter::Update(Security::IdType id, double last_price,
                                double last_qty) {
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   auto& t = md.trade;
   if (last_price > 0) UpdatePx(last_price, &t);
   if (last_qty > 0) UpdateVolume(last_qty, &t);
+  if (last_price > 0) {
+    PositionManager::Instance().UpdatePnl(id);
+    if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
+  }
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -123,8 +136,10 @@ void MarketDataAdapter::Update(Security::IdType id, double last_price,
 
 void MarketDataAdapter::UpdateAskPrice(Security::IdType id, double v) {
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   md.depth[0].ask_price = v;
+  if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -132,6 +147,7 @@ void MarketDataAdapter::UpdateAskPrice(Security::IdType id, double v) {
 
 void MarketDataAdapter::UpdateAskSize(Security::IdType id, double v) {
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   md.depth[0].ask_size = v;
   auto& x = AlgoManager::Instance();
@@ -141,8 +157,10 @@ void MarketDataAdapter::UpdateAskSize(Security::IdType id, double v) {
 
 void MarketDataAdapter::UpdateBidPrice(Security::IdType id, double v) {
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   md.depth[0].bid_price = v;
+  if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -150,6 +168,7 @@ void MarketDataAdapter::UpdateBidPrice(Security::IdType id, double v) {
 
 void MarketDataAdapter::UpdateBidSize(Security::IdType id, double v) {
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   md.depth[0].bid_size = v;
   auto& x = AlgoManager::Instance();
@@ -160,8 +179,11 @@ void MarketDataAdapter::UpdateBidSize(Security::IdType id, double v) {
 void MarketDataAdapter::UpdateLastPrice(Security::IdType id, double v) {
   if (v <= 0) return;
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   UpdatePx(v, &md.trade);
+  PositionManager::Instance().UpdatePnl(id);
+  if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
   auto& x = AlgoManager::Instance();
   if (!x.IsSubscribed(src_, id)) return;
   x.Update(src_, id);
@@ -170,6 +192,7 @@ void MarketDataAdapter::UpdateLastPrice(Security::IdType id, double v) {
 void MarketDataAdapter::UpdateLastSize(Security::IdType id, double v) {
   if (v <= 0) return;
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   md.tm = time(nullptr);
   UpdateVolume(v, &md.trade);
   auto& x = AlgoManager::Instance();
@@ -179,12 +202,15 @@ void MarketDataAdapter::UpdateLastSize(Security::IdType id, double v) {
 
 void MarketDataAdapter::UpdateMidAsLastPrice(Security::IdType id) {
   auto& md = (*md_)[id];
+  md.tick_ns = NowInNano();
   auto& q = md.quote();
   auto& t = md.trade;
   if (q.ask_price > q.bid_price && q.bid_price > 0) {
     auto px = (q.ask_price + q.bid_price) / 2;
     UpdatePx(px, &t);
     md.tm = time(nullptr);
+    PositionManager::Instance().UpdatePnl(id);
+    if (!src_) RiskManager::Instance().UpdatePriceBand(id, md);
     auto& x = AlgoManager::Instance();
     if (!x.IsSubscribed(src_, id)) return;
     x.Update(src_, id);
@@ -13,6 +13,7 @@ namespace opentrade {
 
 struct MarketData {
   time_t tm = 0;
+  int64_t tick_ns = 0;  // NowInNano() of the last update
   struct Trade {
     double open = 0;
     double high = 0;
@@ -0,0 +1,64 @@
+#ifndef OPENTRADE_MPSC_QUEUE_H_
+#define OPENTRADE_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace opentrade {
+
+// Bounded lock-free queue for many producers and one consumer. Producers claim
+// a slot with one fetch_add on the tail and publish it through the slot's
+// sequence number, the consumer owns the head, so neither side ever takes a
+// lock nor allocates. Push spins (yielding) while the queue is full, which
+// only happens if the consumer falls 2^kBits items behind.
+template <typename T, int kBits = 16>
+class MpscQueue {
+ public:
+  static constexpr uint64_t kCapacity = 1ull << kBits;
+
+  MpscQueue() : slots_(new Slot[kCapacity]) {
+    for (auto i = 0u; i < kCapacity; ++i) slots_[i].seq = i;
+  }
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  void Push(const T& v) {
+    auto pos = tail_.fetch_add(1, std::memory_order_relaxed);
+    auto& slot = slots_[pos & (kCapacity - 1)];
+    while (slot.seq.load(std::memory_order_acquire) != pos)
+      std::this_thread::yield();
+    slot.value = v;
+    slot.seq.store(pos + 1, std::memory_order_release);
+  }
+
+  // consumer only
+  bool TryPop(T* v) {
+    auto& slot = slots_[head_ & (kCapacity - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != head_ + 1) return false;
+    *v = slot.value;
+    slot.seq.store(head_ + kCapacity, std::memory_order_release);
+    head_++;
+    return true;
+  }
+
+  // consumer only, an item being pushed counts as not there yet
+  bool empty() const {
+    auto& slot = slots_[head_ & (kCapacity - 1)];
+    return slot.seq.load(std::memory_order_acquire) != head_ + 1;
+  }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> seq;
+    T value;
+  };
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+  alignas(64) uint64_t head_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_MPSC_QUEUE_H_
@@ -0,0 +1,81 @@
+#ifndef OPENTRADE_OBJECT_POOL_H_
+#define OPENTRADE_OBJECT_POOL_H_
+
+#include <tbb/spin_mutex.h>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace opentrade {
+
+// Slab allocator for objects of one type. Slabs are never released nor moved,
+// so an object keeps its address until it is explicitly deleted, after which
+// its slot is recycled through a free list. Neighbouring allocations share
+// slabs, which keeps hot objects close together in memory.
+template <typename T, size_t kSlabSize = 4096>
+class ObjectPool {
+ public:
+  ObjectPool() = default;
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  template <typename... Args>
+  T* New(Args&&... args) {
+    return new (Allocate()) T(std::forward<Args>(args)...);
+  }
+
+  void Delete(T* p) {
+    if (!p) return;
+    p->~T();
+    Deallocate(p);
+  }
+
+  size_t size() const { return size_; }  // objects in use
+  size_t capacity() const {
+    tbb::spin_mutex::scoped_lock lock(m_);
+    return slabs_.size() * kSlabSize;
+  }
+
+ private:
+  union Slot {
+    Slot* next;
+    alignas(T) char buf[sizeof(T)];
+  };
+
+  void* Allocate() {
+    tbb::spin_mutex::scoped_lock lock(m_);
+    size_++;
+    if (free_) {
+      auto slot = free_;
+      free_ = slot->next;
+      return slot;
+    }
+    if (!cursor_ || cursor_ == end_) {
+      cursor_ = new Slot[kSlabSize];
+      end_ = cursor_ + kSlabSize;
+      slabs_.push_back(cursor_);
+    }
+    return cursor_++;
+  }
+
+  void Deallocate(void* p) {
+    auto slot = static_cast<Slot*>(p);
+    tbb::spin_mutex::scoped_lock lock(m_);
+    size_--;
+    slot->next = free_;
+    free_ = slot;
+  }
+
+ private:
+  mutable tbb::spin_mutex m_;
+  std::vector<Slot*> slabs_;
+  Slot* free_ = nullptr;
+  Slot* cursor_ = nullptr;
+  Slot* end_ = nullptr;
+  std::atomic<size_t> size_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_OBJECT_POOL_H_
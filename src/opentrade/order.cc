@@ -4,6 +4,7 @@
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -22,8 +23,11 @@ namespace opentrade {
 
 static TaskPool kReadTaskPool;
 TaskPool kWriteTaskPool;
+static TaskPool kCancelTaskPool(4);
+static ObjectPool<Confirmation> kConfirmationPool;
 
 static auto kPath = fs::path(".") / "store" / "confirmations";
+static auto kArchivePath = fs::path(".") / "store" / "archived_orders";
 
 void GlobalOrderBook::Initialize() {
   auto& self = Instance();
@@ -47,12 +51,31 @@ void GlobalOrderBook::Initialize() {
   self.seq_counter_ += 1000;
 }
 
-inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
+Confirmation::Ptr Confirmation::New() {
+  return Ptr(kConfirmationPool.New());
+}
+
+void intrusive_ptr_add_ref(Confirmation* cm) {
+  cm->ref_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(Confirmation* cm) {
+  if (cm->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    kConfirmationPool.Delete(cm);
+}
+
+inline void GlobalOrderBook::UpdateOrder(Confirmation* cm) {
   switch (cm->exec_type) {
     case kUnconfirmedNew:
-    case kUnconfirmedCancel:
-      orders_.emplace(cm->order->id, cm->order);
-      break;
+    case kUnconfirmedCancel: {
+      // an id is indexed once, never replace the order holding it
+      Order* expected = nullptr;
+      if (!orders_[cm->order->id].compare_exchange_strong(
+              expected, cm->order, std::memory_order_acq_rel)) {
+        LOG_ERROR("Order id " << cm->order->id
+                              << " is taken already, not indexed");
+      }
+    } break;
     case kPartiallyFilled:
     case kFilled:
       if (cm->exec_trans_type == kTransNew) {
@@ -99,15 +122,81 @@ inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
     default:
       break;
   }
+  auto ord = cm->order;
+  if (!ord->orig_id && ord->IsLive() != ord->live_links.linked) {
+    if (ord->live_links.linked)
+      UnlinkLive(ord);
+    else
+      LinkLive(ord);
+  }
 }
 
-void GlobalOrderBook::Handle(Confirmation::Ptr cm, bool offline) {
+static inline uint32_t LiveOrderKey(const Order& ord, int scope) {
+  switch (scope) {
+    case kLiveBySubAccount:
+      return ord.sub_account->id;
+    case kLiveByBrokerAccount:
+      return ord.broker_account ? ord.broker_account->id : 0;
+    case kLiveByUser:
+      return ord.user->id;
+    case kLiveBySecurity:
+      return ord.sec->id;
+    default:
+      return 0;
+  }
+}
+
+void GlobalOrderBook::LinkLive(Order* ord) {
+  auto& links = ord->live_links;
+  tbb::spin_mutex::scoped_lock lock(live_m_);
+  for (auto i = 0; i < kNumLiveOrderScopes; ++i) {
+    auto& head = live_orders_[i][LiveOrderKey(*ord, i)];
+    links.prev[i] = nullptr;
+    links.next[i] = head;
+    if (head) head->live_links.prev[i] = ord;
+    head = ord;
+  }
+  links.linked = true;
+}
+
+void GlobalOrderBook::UnlinkLive(Order* ord) {
+  auto& links = ord->live_links;
+  tbb::spin_mutex::scoped_lock lock(live_m_);
+  for (auto i = 0; i < kNumLiveOrderScopes; ++i) {
+    auto prev = links.prev[i];
+    auto next = links.next[i];
+    if (prev)
+      prev->live_links.next[i] = next;
+    else
+      live_orders_[i][LiveOrderKey(*ord, i)] = next;
+    if (next) next->live_links.prev[i] = prev;
+    links.prev[i] = links.next[i] = nullptr;
+  }
+  links.linked = false;
+}
+
+std::vector<Order*> GlobalOrderBook::GetLiveOrders(LiveOrderScope scope,
+                                                   uint32_t id) const {
+  std::vector<Order*> out;
+  tbb::spin_mutex::scoped_lock lock(live_m_);
+  auto it = live_orders_[scope].find(id);
+  if (it == live_orders_[scope].end()) return out;
+  for (auto ord = it->second; ord; ord = ord->live_links.next[scope])
+    out.push_back(ord);
+  return out;
+}
+
+void GlobalOrderBook::Handle(const Confirmation::Ptr& cm, bool offline) {
   if (cm->order->id <= 0) {  // risk rejected
     assert(!offline);
+    {
+      tbb::spin_mutex::scoped_lock lock(unnumbered_m_);
+      unnumbered_orders_.push_back(cm->order);
+    }
     Server::Publish(cm);
     return;
   }
-  UpdateOrder(cm);
+  UpdateOrder(cm.get());
   PositionManager::Instance().Handle(cm, offline);
   if (cm->order->inst) AlgoManager::Instance().Handle(cm);
   if (offline) return;
@@ -221,7 +310,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
           LOG_ERROR("Unknown order id " << id << " on confirmation line #"
                                         << ln);
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -257,19 +346,19 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
           conn->Send(cm, true);
           continue;
         }
-        if (IsDupExecId(exec_id)) {  // not only double check, but also insert
-                                     // into exec_ids_
-          LOG_ERROR("Duplicate exec id " << exec_id << " on confirmation line #"
-                                         << ln);
-          continue;
-        }
         auto ord = Get(id);
         if (!ord) {
           LOG_ERROR("Unknown order id " << id << " on confirmation line #"
                                         << ln);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        // not only double check, but also insert into exec_ids_
+        if (IsDupExecId(exec_id, *ord)) {
+          LOG_ERROR("Duplicate exec id " << exec_id << " on confirmation line #"
+                                         << ln);
+          continue;
+        }
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -314,7 +403,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                                         << ln);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -396,7 +485,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                     << broker_account_id << " on confirmation line #" << ln);
           continue;
         }
-        auto ord = new Order{};
+        auto ord = NewOrder();
         ord->id = id;
         ord->algo_id = algo_id;
         ord->qty = qty;
@@ -411,7 +500,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
         ord->sub_account = sub_account;
         ord->broker_account = broker_account;
         ord->tm = tm;
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -433,12 +522,12 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                                        << ln);
           continue;
         }
-        auto cancel_order = new Order(*orig_ord);
+        auto cancel_order = NewOrder(*orig_ord);
         cancel_order->id = id;
         cancel_order->orig_id = orig_id;
         cancel_order->status = kUnconfirmedCancel;
         cancel_order->tm = tm;
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = cancel_order;
         cm->transaction_time = tm;
@@ -469,7 +558,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
           conn->Send(cm, true);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->text = text;
@@ -486,10 +575,127 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
 }
 
 void GlobalOrderBook::Cancel() {
-  for (auto& pair : orders_) {
-    auto ord = pair.second;
-    if (ord->IsLive()) ExchangeConnectivityManager::Instance().Cancel(*ord);
+  std::vector<Order*> ords;
+  {
+    tbb::spin_mutex::scoped_lock lock(live_m_);
+    for (auto& pair : live_orders_[kLiveBySubAccount]) {
+      for (auto ord = pair.second; ord;
+           ord = ord->live_links.next[kLiveBySubAccount])
+        ords.push_back(ord);
+    }
+  }
+  Cancel(ords);
+}
+
+size_t GlobalOrderBook::Cancel(LiveOrderScope scope, uint32_t id) {
+  auto ords = GetLiveOrders(scope, id);
+  Cancel(ords);
+  return ords.size();
+}
+
+void GlobalOrderBook::Cancel(const std::vector<Order*>& ords) {
+  std::unordered_map<ExchangeConnectivityAdapter*, std::vector<Order*>>
+      per_adapter;
+  for (auto ord : ords) {
+    per_adapter[ord->broker_account ? ord->broker_account->adapter : nullptr]
+        .push_back(ord);
+  }
+  std::vector<std::future<void>> done;
+  for (auto& pair : per_adapter) {
+    auto task = std::make_shared<std::packaged_task<void()>>(
+        [ords = std::move(pair.second)]() {
+          for (auto ord : ords) {
+            if (ord->IsLive())
+              ExchangeConnectivityManager::Instance().Cancel(*ord);
+          }
+        });
+    done.push_back(task->get_future());
+    kCancelTaskPool.AddTask([task]() { (*task)(); });
+  }
+  // callers, e.g. the kill switch at shutdown, rely on all cancels having
+  // been handed over to the adapters when this returns
+  for (auto& f : done) f.wait();
+}
+
+void GlobalOrderBook::Retire() {
+  std::ofstream of(kArchivePath.c_str(), std::ofstream::app);
+  if (!of.good()) {
+    LOG_ERROR("Failed to write file: " << kArchivePath.c_str() << ": "
+                                       << strerror(errno));
+    return;
+  }
+  // retired a whole cycle ago, nothing refers to them any more
+  for (auto ord : retiring_) order_pool_.Delete(ord);
+  auto nreleased = retiring_.size();
+  retiring_.clear();
+  std::vector<Order*> retired;
+  orders_.ForEach([this, &retired](Order::IdType,
+                                   const std::atomic<Order*>& slot) {
+    auto ord = slot.load(std::memory_order_acquire);
+    if (!ord || ord == &kRetired) return;
+    if (ord->orig_id) {  // cancel request, kept as long as the original
+      auto orig_ord = Get(ord->orig_id);
+      if (orig_ord && !orig_ord->IsTerminal()) return;
+    } else if (!ord->IsTerminal()) {
+      return;
+    }
+    retired.push_back(ord);
+  });
+  for (auto ord : retired) {
+    ArchivedOrder a;
+    a.id = ord->id;
+    a.orig_id = ord->orig_id;
+    a.algo_id = ord->algo_id;
+    a.sec_id = ord->sec->id;
+    a.user_id = ord->user->id;
+    a.sub_account_id = ord->sub_account->id;
+    a.broker_account_id = ord->broker_account ? ord->broker_account->id : 0;
+    a.status = ord->status;
+    a.side = ord->side;
+    a.type = ord->type;
+    a.tif = ord->tif;
+    a.qty = ord->qty;
+    a.price = ord->price;
+    a.avg_px = ord->avg_px;
+    a.cum_qty = ord->cum_qty;
+    a.tm = ord->tm;
+    of.write(reinterpret_cast<const char*>(&a), sizeof(a));
+  }
+  of.flush();
+  for (auto ord : retired) {
+    orders_[ord->id].store(&kRetired, std::memory_order_release);
+    retiring_.push_back(ord);
+  }
+  size_t n;
+  {
+    tbb::spin_mutex::scoped_lock lock(unnumbered_m_);
+    n = unnumbered_orders_.size();
+    retiring_.insert(retiring_.end(), unnumbered_orders_.begin(),
+                     unnumbered_orders_.end());
+    unnumbered_orders_.clear();
   }
+  LOG_INFO("Retired " << retired.size() << " terminal orders and " << n
+                      << " rejected orders, released " << nreleased
+                      << " retired last time, " << order_pool_.size()
+                      << " orders remain in memory");
+}
+
+void GlobalOrderBook::ScheduleRetire(int seconds) {
+  time_t t = time(NULL);
+  struct tm now;
+  localtime_r(&t, &now);
+  auto secs = now.tm_hour * 3600 + now.tm_min * 60 + now.tm_sec;
+  auto delay = (seconds - secs + kSecondsOneDay) % kSecondsOneDay;
+  if (!delay) delay = kSecondsOneDay;
+  // run on the journal writer, so that no pending write refers to a retired
+  // order
+  kWriteTaskPool.AddTask(
+      [this, seconds]() {
+        Retire();
+        exec_ids_.Clear();
+        ScheduleRetire(seconds);
+      },
+      boost::posix_time::seconds(delay));
 }
 
 }  // namespace opentrade
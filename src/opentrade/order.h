@@ -1,19 +1,26 @@
 #ifndef OPENTRADE_ORDER_H_
 #define OPENTRADE_ORDER_H_
 
-#include <tbb/concurrent_unordered_map.h>
-#include <tbb/concurrent_unordered_set.h>
+#include <tbb/spin_mutex.h>
 #include <any>
 #include <atomic>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
 #include <fstream>
 #include <map>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <variant>
+#include <vector>
 
 #include "account.h"
 #include "common.h"
+#include "exec_id_filter.h"
+#include "object_pool.h"
+#include "segmented_array.h"
 #include "security.h"
+#include "small_string.h"
 
 namespace opentrade {
 
@@ -90,6 +97,37 @@ struct Contract {
 };
 
 class Instrument;
+struct Order;
+
+enum LiveOrderScope {
+  kLiveBySubAccount,
+  kLiveByBrokerAccount,
+  kLiveByUser,
+  kLiveBySecurity,
+  kNumLiveOrderScopes,
+};
+
+// intrusive hooks of the live order lists in GlobalOrderBook, one per scope,
+// a copied order starts unlinked
+struct LiveOrderLinks {
+  LiveOrderLinks() = default;
+  LiveOrderLinks(const LiveOrderLinks&) {}
+  LiveOrderLinks& operator=(const LiveOrderLinks&) { return *this; }
+  Order* prev[kNumLiveOrderScopes] = {};
+  Order* next[kNumLiveOrderScopes] = {};
+  bool linked = false;
+};
+
+// NowInNano() when a new order passed each stage, 0 if it did not
+struct OrderTimes {
+  int64_t tick = 0;      // market data update the algo reacted to
+  int64_t dispatch = 0;  // algo callback invoked
+  int64_t place = 0;     // ExchangeConnectivityManager::Place entered
+  int64_t risk = 0;      // risk check passed
+  int64_t send = 0;      // handed to the adapter by the sender thread
+  int64_t ack = 0;       // first confirmation from the venue
+  int64_t fill = 0;      // first fill
+};
 
 struct Order : public Contract {
   OrderStatus status = kUnconfirmedNew;
@@ -104,19 +142,52 @@ struct Order : public Contract {
   const User* user = nullptr;
   const BrokerAccount* broker_account = nullptr;
   const Instrument* inst = nullptr;
+  LiveOrderLinks live_links;
+  OrderTimes times;
 
   bool IsLive() const {
     return status == kUnconfirmedNew || status == kPendingNew ||
            status == kNew || status == kPartiallyFilled;
   }
+
+  // no more confirmation expected
+  bool IsTerminal() const {
+    return status == kFilled || status == kCanceled || status == kRejected ||
+           status == kExpired || status == kCalculated ||
+           status == kDoneForDay || status == kRiskRejected;
+  }
 };
 
+// final state of a retired order, packed for archive
+#pragma pack(push, 1)
+struct ArchivedOrder {
+  Order::IdType id = 0;
+  Order::IdType orig_id = 0;
+  uint32_t algo_id = 0;
+  Security::IdType sec_id = 0;
+  User::IdType user_id = 0;
+  SubAccount::IdType sub_account_id = 0;
+  BrokerAccount::IdType broker_account_id = 0;
+  char status = 0;
+  char side = 0;
+  char type = 0;
+  char tif = 0;
+  double qty = 0;
+  double price = 0;
+  double avg_px = 0;
+  double cum_qty = 0;
+  int64_t tm = 0;
+};
+#pragma pack(pop)
+
+// pooled and intrusively reference counted, created with Confirmation::New()
 struct Confirmation {
-  typedef std::shared_ptr<Confirmation> Ptr;
+  typedef boost::intrusive_ptr<Confirmation> Ptr;
+  static Ptr New();
   Order* order = nullptr;
-  std::string exec_id;
-  std::string order_id;
-  std::string text;
+  SmallString<48> exec_id;
+  SmallString<32> order_id;
+  SmallString<64> text;
   OrderStatus exec_type = kUnconfirmedNew;
   ExecTransType exec_trans_type = kTransNew;
   union {
@@ -126,34 +197,86 @@ struct Confirmation {
   double last_px = 0;
   int64_t transaction_time = 0;  // utc in microseconds
   uint32_t seq = 0;
+  std::atomic<uint32_t> ref_count = 0;
 };
 
+void intrusive_ptr_add_ref(Confirmation* cm);
+void intrusive_ptr_release(Confirmation* cm);
+
 class Connection;
 
 class GlobalOrderBook : public Singleton<GlobalOrderBook> {
  public:
   static void Initialize();
   uint32_t NewOrderId() { return ++order_id_counter_; }
-  bool IsDupExecId(const std::string& exec_id) {
-    return !exec_ids_.insert(exec_id).second;
+  Order* NewOrder() { return order_pool_.New(); }
+  Order* NewOrder(const Order& ord) { return order_pool_.New(ord); }
+  bool IsDupExecId(std::string_view exec_id, const Order& ord) {
+    uint64_t scope = 0;
+    if (exec_id_per_adapter_ && ord.broker_account) {
+      auto name = ord.broker_account->adapter_name;
+      scope = ExecIdFilter::Hash(name, strlen(name));
+    }
+    return exec_ids_.IsDup(exec_id, scope);
+  }
+  // window: number of exec ids remembered at least
+  void SetExecIdDedup(size_t window, bool per_adapter) {
+    exec_ids_.Reset(2 * window);
+    exec_id_per_adapter_ = per_adapter;
+  }
+  Order* Get(Order::IdType id) const {
+    auto p = orders_.Get(id);
+    auto ord = p ? p->load(std::memory_order_acquire) : nullptr;
+    return ord == &kRetired ? nullptr : ord;
   }
-  Order* Get(Order::IdType id) {
-    auto it = orders_.find(id);
-    return it == orders_.end() ? nullptr : it->second;
+  // the order has been retired by Retire(), its final state is archived
+  bool IsRetired(Order::IdType id) const {
+    auto p = orders_.Get(id);
+    return p && p->load(std::memory_order_acquire) == &kRetired;
   }
+  // cancel all live orders, returns when all cancels are queued to adapters
   void Cancel();
-  void Handle(Confirmation::Ptr cm, bool offline = false);
+  // cancel live orders of one sub account, broker account, user or security,
+  // sent in parallel per adapter, returns number of orders being canceled
+  // once all cancels are queued to adapters
+  size_t Cancel(LiveOrderScope scope, uint32_t id);
+  std::vector<Order*> GetLiveOrders(LiveOrderScope scope, uint32_t id) const;
+  void Handle(const Confirmation::Ptr& cm, bool offline = false);
   void LoadStore(uint32_t seq0 = 0, Connection* conn = nullptr);
+  // archive the final state of terminal orders and drop them from the
+  // index, leaving a tombstone, they are released back to pool by the next
+  // Retire(), so that confirmations still queued for publishing, outbound
+  // queues and cancel tasks never refer to a released order
+  void Retire();
+  // run Retire() and start a new exec id dedup session every day at given
+  // local time (seconds since midnight)
+  void ScheduleRetire(int seconds);
 
  private:
-  void UpdateOrder(Confirmation::Ptr cm);
+  void UpdateOrder(Confirmation* cm);
+  void LinkLive(Order* ord);
+  void UnlinkLive(Order* ord);
+  void Cancel(const std::vector<Order*>& ords);
 
  private:
-  tbb::concurrent_unordered_map<Order::IdType, Order*> orders_;
+  // indexed by order id directly, ids are dense within a session
+  SegmentedArray<std::atomic<Order*>> orders_;
   std::atomic<uint32_t> order_id_counter_ = 0;
   uint32_t seq_counter_ = 0;
-  tbb::concurrent_unordered_set<std::string> exec_ids_;
+  ExecIdFilter exec_ids_;
+  bool exec_id_per_adapter_ = false;
   std::ofstream of_;
+  ObjectPool<Order> order_pool_;
+  // orders rejected before getting an id, never put into orders_
+  std::vector<Order*> unnumbered_orders_;
+  tbb::spin_mutex unnumbered_m_;
+  // retired by the last Retire(), released by the next one
+  std::vector<Order*> retiring_;
+  // tombstone of retired orders in orders_
+  static inline Order kRetired{};
+  // heads of live order lists of every scope, keyed by account or security id
+  std::unordered_map<uint32_t, Order*> live_orders_[kNumLiveOrderScopes];
+  mutable tbb::spin_mutex live_m_;
 };
 
 static inline bool GetOrderSide(const std::string& side_str, OrderSide* side) {
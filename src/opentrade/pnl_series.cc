@@ -0,0 +1,103 @@
+#include "pnl_series.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+
+#include "logger.h"
+
+namespace opentrade {
+
+PnlSeries::PnlSeries(const std::string& path) : path_(path) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0) {
+    LOG_FATAL("Failed to open file: " << path << ": " << strerror(errno));
+  }
+  struct stat st;
+  fstat(fd_, &st);
+  auto n = std::min<size_t>(st.st_size / sizeof(PnlRecord), kMaxRecords);
+  capacity_ = (n + kChunkRecords - 1) / kChunkRecords * kChunkRecords;
+  if (!capacity_) capacity_ = kChunkRecords;
+  if (ftruncate(fd_, capacity_ * sizeof(PnlRecord))) {
+    LOG_FATAL("Failed to resize file: " << path << ": " << strerror(errno));
+  }
+  auto p = mmap(nullptr, kMaxRecords * sizeof(PnlRecord),
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (p == MAP_FAILED) {
+    LOG_FATAL("Failed to mmap file: " << path << ": " << strerror(errno));
+  }
+  data_ = static_cast<PnlRecord*>(p);
+  n = std::partition_point(data_, data_ + capacity_,
+                           [](auto& r) { return r.tm != 0; }) -
+      data_;
+  if (n > kMaxRecords / 2) {
+    // keep the recent half, older history is rarely asked for
+    auto m = kMaxRecords / 4;
+    memmove(data_, data_ + n - m, m * sizeof(PnlRecord));
+    memset(data_ + m, 0, (n - m) * sizeof(PnlRecord));
+    LOG_INFO("Dropped " << n - m << " oldest records of " << path);
+    n = m;
+  }
+  size_.store(n, std::memory_order_release);
+}
+
+PnlSeries::~PnlSeries() {
+  if (data_) munmap(data_, kMaxRecords * sizeof(PnlRecord));
+  if (fd_ >= 0) close(fd_);
+}
+
+bool PnlSeries::Grow() {
+  if (capacity_ >= kMaxRecords) return false;
+  auto n = std::min(capacity_ + kChunkRecords, kMaxRecords);
+  if (ftruncate(fd_, n * sizeof(PnlRecord))) {
+    LOG_ERROR("Failed to resize file: " << path_ << ": " << strerror(errno));
+    return false;
+  }
+  capacity_ = n;
+  return true;
+}
+
+void PnlSeries::Append(time_t tm, double realized, double unrealized) {
+  auto n = size_.load(std::memory_order_relaxed);
+  if (n >= capacity_ && !Grow()) {
+    LOG_ERROR("Pnl series full, dropped: " << path_);
+    return;
+  }
+  if (n && data_[n - 1].tm > tm) tm = data_[n - 1].tm;
+  auto& r = data_[n];
+  r.realized = realized;
+  r.unrealized = unrealized;
+  r.tm = tm;
+  size_.store(n + 1, std::memory_order_release);
+}
+
+size_t PnlSeries::Import(const std::string& text_path) {
+  std::ifstream f(text_path.c_str());
+  if (!f.good()) return 0;
+  auto n0 = size();
+  std::string line;
+  while (std::getline(f, line)) {
+    int64_t tm;
+    double realized, unrealized;
+    if (3 != sscanf(line.c_str(), "%" SCNd64 " %lf %lf", &tm, &realized,
+                    &unrealized))
+      continue;
+    if (tm <= 0) continue;
+    Append(tm, realized, unrealized);
+  }
+  return size() - n0;
+}
+
+size_t PnlSeries::LowerBound(time_t tm, size_t first, size_t last) const {
+  return std::lower_bound(data_ + first, data_ + last, tm,
+                          [](auto& r, time_t tm) { return r.tm < tm; }) -
+         data_;
+}
+
+}  // namespace opentrade
@@ -0,0 +1,79 @@
+#ifndef OPENTRADE_PNL_SERIES_H_
+#define OPENTRADE_PNL_SERIES_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+namespace opentrade {
+
+// fixed size record of pnl series
+#pragma pack(push, 1)
+struct PnlRecord {
+  int64_t tm = 0;  // utc in seconds, never 0 for a written record
+  double realized = 0;
+  double unrealized = 0;
+};
+#pragma pack(pop)
+
+// Append-only time series of one account's pnl, stored as an array of
+// PnlRecord in a memory mapped file. The whole address range of kMaxRecords
+// is mapped once, the file grows in chunks of kChunkRecords zero records
+// behind it, so readers never see a remap and the end of the series is found
+// on open by binary search for the first zero timestamp. Timestamps are
+// non-decreasing, which makes range queries binary searches.
+// Single writer, any number of concurrent readers.
+class PnlSeries {
+ public:
+  static const size_t kChunkRecords = 4096;
+  static const size_t kMaxRecords = 1 << 22;  // 96MB address space
+
+  explicit PnlSeries(const std::string& path);
+  ~PnlSeries();
+  PnlSeries(const PnlSeries&) = delete;
+  PnlSeries& operator=(const PnlSeries&) = delete;
+
+  void Append(time_t tm, double realized, double unrealized);
+  // appends the "<tm> <realized> <unrealized>" lines of the text history
+  // written by earlier versions to store/pnl-<id>, returns records imported
+  size_t Import(const std::string& text_path);
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+  const PnlRecord& operator[](size_t i) const { return data_[i]; }
+  // index of the first record in [first, last) with timestamp >= tm
+  size_t LowerBound(time_t tm, size_t first, size_t last) const;
+  size_t LowerBound(time_t tm) const { return LowerBound(tm, 0, size()); }
+  // call func(const PnlRecord&) on records in [from, to); if interval > 0,
+  // only on the last record of every interval seconds, costing a binary
+  // search per point returned rather than a scan of the range
+  template <typename Func>
+  void Query(time_t from, time_t to, int interval, Func func) const {
+    auto n = size();
+    auto i = LowerBound(from, 0, n);
+    while (i < n && data_[i].tm < to) {
+      if (interval <= 0) {
+        func(data_[i++]);
+        continue;
+      }
+      time_t next = (data_[i].tm / interval + 1) * interval;
+      auto j = LowerBound(std::min(next, to), i + 1, n);
+      func(data_[j - 1]);
+      i = j;
+    }
+  }
+
+ private:
+  bool Grow();
+
+ private:
+  int fd_ = -1;
+  PnlRecord* data_ = nullptr;
+  size_t capacity_ = 0;  // records backed by file
+  std::atomic<size_t> size_ = 0;
+  std::string path_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_PNL_SERIES_H_
@@ -3,6 +3,7 @@
 #include <postgresql/soci-postgresql.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/filesystem.hpp>
+#include <cinttypes>
 #include <fstream>
 #include <mutex>
 
@@ -91,9 +92,7 @@ inline void Position::HandleNew(bool is_buy, double qty, double price,
   PositionValue::HandleNew(is_buy, qty, price, multiplier);
 }
 
-void PositionManager::Initialize() {
-  Instance().sql_ = Database::Session();
-
+void PositionManager::Initialize(int flush_interval_ms, size_t batch_size) {
   auto& self = Instance();
   auto sql = Database::Session();
 
@@ -130,44 +129,137 @@ void PositionManager::Initialize() {
   )";
   soci::rowset<soci::row> st = (sql->prepare << query, soci::use(tm));
   for (auto it = st.begin(); it != st.end(); ++it) {
-    Position p{};
     auto i = 0;
     auto sub_account_id = Database::GetValue(*it, i++, 0);
     auto broker_account_id = Database::GetValue(*it, i++, 0);
     auto security_id = Database::GetValue(*it, i++, 0);
-    auto sec = SecurityManager::Instance().Get(security_id);
-    if (!sec) continue;
-    p.qty = Database::GetValue(*it, i++, 0.);
-    p.avg_price = Database::GetValue(*it, i++, 0.);
-    p.realized_pnl = Database::GetValue(*it, i++, 0.);
+    if (!SecurityManager::Instance().Get(security_id)) continue;
     Bod bod{};
-    bod.qty = p.qty;
-    bod.avg_price = p.avg_price;
-    bod.realized_pnl = p.realized_pnl;
+    bod.qty = Database::GetValue(*it, i++, 0.);
+    bod.avg_price = Database::GetValue(*it, i++, 0.);
+    bod.realized_pnl = Database::GetValue(*it, i++, 0.);
     bod.broker_account_id = broker_account_id;
-    tm = Database::GetValue(*it, i++, tm);
-    bod.tm = mktime(&tm);
+    auto tm2 = Database::GetValue(*it, i++, tm);
+    bod.tm = mktime(&tm2);
     self.bods_.emplace(std::make_pair(sub_account_id, security_id), bod);
-    self.sub_positions_.emplace(std::make_pair(sub_account_id, security_id), p);
-    auto& p2 =
-        self.broker_positions_[std::make_pair(broker_account_id, security_id)];
+  }
+
+  // earlier sessions' positions which may not have been replicated yet
+  for (auto& pair : PositionWal::LoadEarlierSessions(self.session_)) {
+    auto& rec = pair.second;
+    if (!SecurityManager::Instance().Get(rec.security_id)) continue;
+    auto& bod = self.bods_[pair.first];
+    bod.qty = rec.qty;
+    bod.avg_price = rec.avg_price;
+    bod.realized_pnl = rec.realized_pnl;
+    bod.broker_account_id = rec.broker_account_id;
+    bod.tm = rec.tm / 1000000;
+  }
+
+  for (auto& pair : self.bods_) {
+    auto security_id = pair.first.second;
+    auto sec = SecurityManager::Instance().Get(security_id);
+    auto& bod = pair.second;
+    Position p{};
+    p.qty = bod.qty;
+    p.avg_price = bod.avg_price;
+    p.realized_pnl = bod.realized_pnl;
+    auto& pos = self.sub_positions_.emplace(pair.first, p).first->second;
+    self.AddPnlPosition(*sec, pair.first.first, &pos);
+    auto& p2 = self.broker_positions_[std::make_pair(bod.broker_account_id,
+                                                     security_id)];
     p2.realized_pnl += p.realized_pnl;
     HandlePnl(p.qty, p.avg_price, sec->multiplier * sec->rate, &p2);
     p2.qty += p.qty;
   }
+
+  self.wal_ = std::make_unique<PositionWal>(
+      Database::Session(), self.session_, flush_interval_ms, batch_size);
 }
 
-static TaskPool kDatabaseTaskPool;
+// Positions and position values are guarded by mutexes striped by account id,
+// so that confirmations of different accounts are handled in parallel. The
+// sub account, broker account and user parts are locked one after another,
+// never nested, hence no lock ordering issue.
+static const size_t kNumStripes = 64;
+static std::mutex kSubAccountMutexes[kNumStripes];
+static std::mutex kBrokerAccountMutexes[kNumStripes];
+static std::mutex kUserMutexes[kNumStripes];
 
-void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
+template <typename Func, typename Func2>
+inline void PositionManager::Update(const Order& ord, Func func,
+                                    Func2 on_sub_position) {
+  auto sec_id = ord.sec->id;
+  double price = 0;
+  if (pnl_started_) {
+    auto slot = pnl_securities_.Get(sec_id);
+    auto sec = slot ? slot->load(std::memory_order_acquire) : nullptr;
+    if (sec) price = sec->price;
+    // first position in this security, also subscribes its market data,
+    // which must not happen with the lock held
+    if (!price) price = ord.sec->CurrentPrice();
+  }
+  {
+    auto id = ord.sub_account->id;
+    std::lock_guard<std::mutex> lock(kSubAccountMutexes[id % kNumStripes]);
+    auto key = std::make_pair(id, sec_id);
+    auto it = sub_positions_.find(key);
+    if (it == sub_positions_.end()) {
+      it = sub_positions_.emplace(key, Position{}).first;
+      AddPnlPosition(*ord.sec, id, &it->second);
+    }
+    auto& p = it->second;
+    auto p0 = p;
+    func(&p, &const_cast<SubAccount*>(ord.sub_account)->position_value);
+    auto sec = pnl_securities_.Get(sec_id)->load(std::memory_order_acquire);
+    if (sec->price)
+      price = sec->price;
+    else
+      sec->price = price;
+    Mark(*p.pnl_position, price, p0);
+    on_sub_position(p);
+  }
+  {
+    auto id = ord.broker_account->id;
+    std::lock_guard<std::mutex> lock(kBrokerAccountMutexes[id % kNumStripes]);
+    func(&broker_positions_[std::make_pair(id, sec_id)],
+         &const_cast<BrokerAccount*>(ord.broker_account)->position_value);
+  }
+  {
+    auto id = ord.user->id;
+    std::lock_guard<std::mutex> lock(kUserMutexes[id % kNumStripes]);
+    func(&user_positions_[std::make_pair(id, sec_id)],
+         &const_cast<User*>(ord.user)->position_value);
+  }
+}
+
+void PositionManager::Persist(const Confirmation::Ptr& cm,
+                              const Position& pos) {
+  auto ord = cm->order;
+  PositionRecord rec;
+  rec.user_id = ord->user->id;
+  rec.sub_account_id = ord->sub_account->id;
+  rec.security_id = ord->sec->id;
+  rec.broker_account_id = ord->broker_account->id;
+  rec.qty = pos.qty;
+  rec.avg_price = pos.avg_price;
+  rec.realized_pnl = pos.realized_pnl;
+  rec.tm = NowUtcInMicro();
+  snprintf(rec.desc, sizeof(rec.desc),
+           "tm=%" PRId64 ",qty=%.15g,px=%.15g,side=%c,type=%c,id=%u%s",
+           cm->transaction_time, cm->last_shares, cm->last_px,
+           static_cast<char>(ord->side), static_cast<char>(ord->type),
+           ord->id, cm->exec_trans_type == kTransCancel ? ",bust=1" : "");
+  wal_->Append(rec);
+}
+
+void PositionManager::Handle(const Confirmation::Ptr& cm, bool offline) {
   auto ord = cm->order;
   auto sec = ord->sec;
   auto multiplier = sec->rate * sec->multiplier;
   bool is_buy = ord->IsBuy();
   auto is_otc = ord->type == kOTC;
   assert(cm && ord->id > 0);
-  static std::mutex kMutex;
-  std::lock_guard<std::mutex> lock(kMutex);
   switch (cm->exec_type) {
     case kPartiallyFilled:
     case kFilled: {
@@ -181,83 +273,26 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       auto qty = cm->last_shares;
       auto px = cm->last_px;
       auto px0 = ord->price;
-      auto& pos = sub_positions_[std::make_pair(ord->sub_account->id, sec->id)];
-      pos.HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc);
-      broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-          .HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc);
-      user_positions_[std::make_pair(ord->user->id, sec->id)].HandleTrade(
-          is_buy, qty, px, px0, multiplier, is_bust, is_otc);
-      const_cast<SubAccount*>(ord->sub_account)
-          ->position_value.HandleTrade(is_buy, qty, px, px0, multiplier,
-                                       is_bust, is_otc);
-      const_cast<BrokerAccount*>(ord->broker_account)
-          ->position_value.HandleTrade(is_buy, qty, px, px0, multiplier,
-                                       is_bust, is_otc);
-      const_cast<User*>(ord->user)->position_value.HandleTrade(
-          is_buy, qty, px, px0, multiplier, is_bust, is_otc);
-      if (offline) return;
-      kDatabaseTaskPool.AddTask([this, pos, cm]() {
-        try {
-          static User::IdType user_id;
-          static SubAccount::IdType sub_account_id;
-          static Security::IdType security_id;
-          static BrokerAccount::IdType broker_account_id;
-          static double qty;
-          static double avg_price;
-          static double realized_pnl;
-          static std::string desc;
-          static const char* cmd = R"(
-            insert into position(user_id, sub_account_id, security_id, 
-            broker_account_id, qty, avg_price, realized_pnl, tm, "desc") 
-            values(:user_id, :sub_account_id, :security_id, :broker_account_id,
-            :qty, :avg_price, :realized_pnl, now() at time zone 'utc', :desc)
-        )";
-          static soci::statement st =
-              (this->sql_->prepare << cmd, soci::use(user_id),
-               soci::use(sub_account_id), soci::use(security_id),
-               soci::use(broker_account_id), soci::use(qty),
-               soci::use(avg_price), soci::use(realized_pnl), soci::use(desc));
-          auto ord = cm->order;
-          user_id = ord->user->id;
-          sub_account_id = ord->sub_account->id;
-          security_id = ord->sec->id;
-          broker_account_id = ord->broker_account->id;
-          qty = pos.qty;
-          avg_price = pos.avg_price;
-          realized_pnl = pos.realized_pnl;
-          static std::stringstream os;
-          os.str("");
-          os << std::setprecision(15) << "tm=" << cm->transaction_time
-             << ",qty=" << cm->last_shares << ",px=" << cm->last_px
-             << ",side=" << static_cast<char>(ord->side)
-             << ",type=" << static_cast<char>(ord->type) << ",id=" << ord->id;
-          if (cm->exec_trans_type == kTransCancel) os << ",bust=1";
-          desc = os.str();
-          st.execute(true);
-        } catch (const soci::postgresql_soci_error& e) {
-          LOG_FATAL("Trying update position to database: \n"
-                    << e.sqlstate() << ' ' << e.what());
-        } catch (const soci::soci_error& e) {
-          LOG_FATAL("Trying update position to database: \n" << e.what());
-        }
-      });
+      // position rows are posted under the sub account lock, so that they
+      // are persisted in the same order as applied
+      Update(
+          *ord,
+          [=](Position* p, PositionValue* v) {
+            p->HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc);
+            v->HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc);
+          },
+          [&](const Position& pos) {
+            if (!offline) Persist(cm, pos);
+          });
     } break;
     case kUnconfirmedNew:
       if (!is_otc) {
         auto qty = ord->qty;
         auto px = ord->price;
-        sub_positions_[std::make_pair(ord->sub_account->id, sec->id)].HandleNew(
-            is_buy, qty, px, multiplier);
-        broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-            .HandleNew(is_buy, qty, px, multiplier);
-        user_positions_[std::make_pair(ord->user->id, sec->id)].HandleNew(
-            is_buy, qty, px, multiplier);
-        const_cast<SubAccount*>(ord->sub_account)
-            ->position_value.HandleNew(is_buy, qty, px, multiplier);
-        const_cast<BrokerAccount*>(ord->broker_account)
-            ->position_value.HandleNew(is_buy, qty, px, multiplier);
-        const_cast<User*>(ord->user)->position_value.HandleNew(is_buy, qty, px,
-                                                               multiplier);
+        Update(*ord, [=](Position* p, PositionValue* v) {
+          p->HandleNew(is_buy, qty, px, multiplier);
+          v->HandleNew(is_buy, qty, px, multiplier);
+        });
       }
       break;
     case kRiskRejected:
@@ -266,63 +301,143 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
     case kExpired:
     case kCalculated:
     case kDoneForDay: {
+      // a failed cancel request, its leaves are copied from the original
+      if (ord->orig_id) break;
       auto qty = cm->leaves_qty;
       auto px = ord->price;
-      sub_positions_[std::make_pair(ord->sub_account->id, sec->id)]
-          .HandleFinish(is_buy, qty, px, multiplier);
-      broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-          .HandleFinish(is_buy, qty, px, multiplier);
-      user_positions_[std::make_pair(ord->user->id, sec->id)].HandleFinish(
-          is_buy, qty, px, multiplier);
-      const_cast<SubAccount*>(ord->sub_account)
-          ->position_value.HandleFinish(is_buy, qty, px, multiplier);
-      const_cast<BrokerAccount*>(ord->broker_account)
-          ->position_value.HandleFinish(is_buy, qty, px, multiplier);
-      const_cast<User*>(ord->user)->position_value.HandleFinish(is_buy, qty, px,
-                                                                multiplier);
+      Update(*ord, [=](Position* p, PositionValue* v) {
+        p->HandleFinish(is_buy, qty, px, multiplier);
+        v->HandleFinish(is_buy, qty, px, multiplier);
+      });
     } break;
     default:
       break;
   }
 }
 
+void PositionManager::AddPnlPosition(const Security& sec,
+                                     SubAccount::IdType id, Position* pos) {
+  auto& slot = pnl_securities_[sec.id];
+  auto p = slot.load(std::memory_order_acquire);
+  if (!p) {
+    auto tmp = new PnlSecurity;
+    tmp->sec = &sec;
+    if (slot.compare_exchange_strong(p, tmp, std::memory_order_acq_rel)) {
+      p = tmp;
+    } else {
+      delete tmp;
+    }
+  }
+  auto pnl = &pnls_[id];
+  PnlPosition pnl_position{pos, pnl, {}, sec.multiplier * sec.rate, id};
+  for (auto i = 0; i < kNumGicsLevels; ++i) {
+    auto level = static_cast<GicsLevel>(i);
+    pnl_position.exposures[i] =
+        &exposures_[GetExposureKey(id, level, GetGicsCode(sec, level))];
+  }
+  pnl->realized += pos->realized_pnl;
+  pnl_position.book_index =
+      pnl->book.Add(sec, pos->qty, pos->avg_price, pos->avg_price);
+  pos->pnl_position = &*p->positions.push_back(pnl_position);
+}
+
+inline void PositionManager::Mark(const PnlPosition& p, double price,
+                                  const Position& pos0) {
+  auto pos = p.pos;
+  if (price > 0) {
+    pos->unrealized_pnl = pos->qty * (price - pos->avg_price);
+    pos->marked_value = pos->qty * price * p.multiplier;
+  }
+  p.pnl->book.Set(p.book_index, pos->qty, pos->avg_price, price);
+  p.pnl->realized += pos->realized_pnl - pos0.realized_pnl;
+  p.pnl->unrealized += pos->unrealized_pnl - pos0.unrealized_pnl;
+  auto net = pos->marked_value - pos0.marked_value;
+  auto gross = std::abs(pos->marked_value) - std::abs(pos0.marked_value);
+  auto buy = pos->total_outstanding_buy - pos0.total_outstanding_buy;
+  auto sell = pos->total_outstanding_sell - pos0.total_outstanding_sell;
+  if (!net && !gross && !buy && !sell) return;
+  for (auto e : p.exposures) {
+    e->net += net;
+    e->gross += gross;
+    e->outstanding_buy += buy;
+    e->outstanding_sell += sell;
+  }
+}
+
+void PositionManager::UpdatePnl(PnlSecurity* sec) {
+  auto price = sec->sec->CurrentPrice();
+  if (!price || price == sec->price.exchange(price)) return;
+  for (auto& p : sec->positions) {
+    std::lock_guard<std::mutex> lock(
+        kSubAccountMutexes[p.sub_account_id % kNumStripes]);
+    auto p0 = *p.pos;
+    Mark(p, price, p0);
+  }
+}
+
+PositionBook PositionManager::GetBook(SubAccount::IdType id) {
+  PositionBook book;
+  if (id) {
+    auto it = pnls_.find(id);
+    if (it == pnls_.end()) return book;
+    std::lock_guard<std::mutex> lock(kSubAccountMutexes[id % kNumStripes]);
+    return it->second.book;
+  }
+  for (auto& pair : pnls_) {
+    std::lock_guard<std::mutex> lock(
+        kSubAccountMutexes[pair.first % kNumStripes]);
+    book.Append(pair.second.book);
+  }
+  return book;
+}
+
+const PnlSeries& PositionManager::GetPnlSeries(SubAccount::IdType id) {
+  auto& pnl = pnls_[id];
+  auto series = pnl.series.load(std::memory_order_acquire);
+  if (series) return *series;
+  static std::mutex kMutex;
+  std::lock_guard<std::mutex> lock(kMutex);
+  series = pnl.series.load(std::memory_order_acquire);
+  if (series) return *series;
+  auto path = fs::path(".") / "store" / ("pnl-" + std::to_string(id));
+  series = new PnlSeries(path.string() + ".bin");
+  if (!series->size() && fs::exists(path)) {
+    // first open after upgrade, the text file is left as is
+    auto n = series->Import(path.string());
+    LOG_INFO("Imported " << n << " pnl records from " << path);
+  }
+  pnl.series.store(series, std::memory_order_release);
+  return *series;
+}
+
 static TaskPool kPnlTaskPool;
 
-void PositionManager::UpdatePnl() {
-  auto tm = time(nullptr);
-  std::map<SubAccount::IdType, std::pair<double, double>> pnls;
-  auto& sm = SecurityManager::Instance();
-  for (auto& pair : sub_positions_) {
-    auto acc = pair.first.first;
-    auto sec_id = pair.first.second;
-    auto& pos = pair.second;
-    auto& pnl = pnls[acc];
-    pnl.first += pos.realized_pnl;
-    if (!pos.qty && !pos.unrealized_pnl) continue;
-    auto sec = sm.Get(sec_id);
-    if (!sec) continue;
-    auto px = sec->CurrentPrice();
-    if (!px) continue;
-    pos.unrealized_pnl = pos.qty * (px - pos.avg_price);
-    pnl.second += pos.unrealized_pnl;
+void PositionManager::PublishPnl(int interval_ms) {
+  if (!pnl_started_) {
+    // initial marks, also subscribes market data of securities held
+    pnl_securities_.ForEach(
+        [this](Security::IdType, const std::atomic<PnlSecurity*>& slot) {
+          auto sec = slot.load(std::memory_order_acquire);
+          if (sec) UpdatePnl(sec);
+        });
+    pnl_started_ = true;
   }
-  for (auto& pair : pnls) {
-    auto& pnl = pnls_[pair.first];
-    if (std::abs(pnl.realized - pair.second.first) < 1 &&
-        std::abs(pnl.unrealized - pair.second.second) < 1)
+  auto tm = time(nullptr);
+  static std::map<SubAccount::IdType, std::pair<double, double>> kPublished;
+  for (auto& pair : pnls_) {
+    auto& pnl = pair.second;
+    auto& pnl0 = kPublished[pair.first];
+    if (std::abs(pnl0.first - pnl.realized) < 1 &&
+        std::abs(pnl0.second - pnl.unrealized) < 1)
       continue;
-    pnl.realized = pair.second.first;
-    pnl.unrealized = pair.second.second;
-    if (!pnl.of) {
-      auto path =
-          fs::path(".") / "store" / ("pnl-" + std::to_string(pair.first));
-      pnl.of = new std::ofstream(path.c_str(), std::ofstream::app);
-    }
-    (*pnl.of) << tm << ' ' << pnl.realized << ' ' << pnl.unrealized
-              << std::endl;
+    pnl0.first = pnl.realized;
+    pnl0.second = pnl.unrealized;
+    const_cast<PnlSeries&>(GetPnlSeries(pair.first))
+        .Append(tm, pnl0.first, pnl0.second);
   }
 
-  kPnlTaskPool.AddTask([this]() { this->UpdatePnl(); }, pt::seconds(5));
+  kPnlTaskPool.AddTask([this, interval_ms]() { PublishPnl(interval_ms); },
+                       pt::milliseconds(interval_ms));
 }
 
 }  // namespace opentrade
@@ -3,18 +3,26 @@
 
 #include <soci.h>
 #include <tbb/concurrent_unordered_map.h>
+#include <tbb/concurrent_vector.h>
 #include <boost/unordered_map.hpp>
+#include <atomic>
 #include <fstream>
 #include <string>
 
 #include "account.h"
 #include "common.h"
 #include "order.h"
+#include "pnl_series.h"
+#include "position_book.h"
+#include "position_wal.h"
+#include "segmented_array.h"
 #include "security.h"
 #include "utility.h"
 
 namespace opentrade {
 
+struct PnlPosition;
+
 struct Position : public PositionValue {
   double qty = 0;
   double avg_price = 0;
@@ -25,6 +33,9 @@ struct Position : public PositionValue {
   double total_sold_qty = 0;
   double total_outstanding_buy_qty = 0;
   double total_outstanding_sell_qty = 0;
+  double marked_value = 0;  // qty * price * multiplier * rate at last mark
+  // account aggregates this position feeds, sub account positions only
+  const PnlPosition* pnl_position = nullptr;
 
   void HandleNew(bool is_buy, double qty, double price, double multiplier);
   void HandleTrade(bool is_buy, double qty, double price, double price0,
@@ -41,11 +52,63 @@ struct Bod {
   BrokerAccount::IdType broker_account_id = 0;
 };
 
+enum GicsLevel {
+  kSector,
+  kIndustryGroup,
+  kIndustry,
+  kSubIndustry,
+  kNumGicsLevels,
+};
+
+static inline int GetGicsCode(const Security& sec, GicsLevel level) {
+  switch (level) {
+    case kSector:
+      return sec.sector;
+    case kIndustryGroup:
+      return sec.industry_group;
+    case kIndustry:
+      return sec.industry;
+    case kSubIndustry:
+      return sec.sub_industry;
+    default:
+      return 0;
+  }
+}
+
+// sub account exposure to one GICS sector, industry group, industry or sub
+// industry, values in account currency
+struct Exposure {
+  double net = 0;  // marked value
+  double gross = 0;
+  double outstanding_buy = 0;
+  double outstanding_sell = 0;
+};
+
+// sub account pnl, maintained incrementally, guarded by the sub account mutex
+struct SubAccountPnl {
+  double realized = 0;
+  double unrealized = 0;
+  std::atomic<PnlSeries*> series = nullptr;
+  PositionBook book;  // one row per position ever held
+};
+
+// the aggregates of a sub account position, resolved once when the position
+// is created so that fills and marks do no map lookup
+struct PnlPosition {
+  Position* pos;
+  SubAccountPnl* pnl;
+  Exposure* exposures[kNumGicsLevels];
+  double multiplier;
+  SubAccount::IdType sub_account_id;
+  size_t book_index;  // row in pnl->book
+};
+
 class PositionManager : public Singleton<PositionManager> {
  public:
-  static void Initialize();
+  static void Initialize(int flush_interval_ms = 100,
+                         size_t batch_size = 1000);
   auto session() { return session_; }
-  void Handle(Confirmation::Ptr cm, bool offline);
+  void Handle(const Confirmation::Ptr& cm, bool offline);
   const Position& Get(const SubAccount& acc, const Security& sec) const {
     return FindInMap(sub_positions_, std::make_pair(acc.id, sec.id));
   }
@@ -55,11 +118,58 @@ class PositionManager : public Singleton<PositionManager> {
   const Position& Get(const User& user, const Security& sec) const {
     return FindInMap(user_positions_, std::make_pair(user.id, sec.id));
   }
-  void UpdatePnl();
+  // recompute pnl of positions in the security after its price changed,
+  // called on every trade tick, cheap if nobody holds the security
+  void UpdatePnl(Security::IdType id) {
+    auto p = pnl_securities_.Get(id);
+    if (!p) return;
+    auto sec = p->load(std::memory_order_acquire);
+    if (sec) UpdatePnl(sec);
+  }
+  // append changed account pnl to its series every interval_ms
+  void PublishPnl(int interval_ms);
+  // store/pnl-<id>.bin, opened on first use, seeded from the text history
+  // store/pnl-<id> of earlier versions if empty
+  const PnlSeries& GetPnlSeries(SubAccount::IdType id);
+  // maintained on every fill and price move, zero if not held
+  const Exposure& GetExposure(SubAccount::IdType id, GicsLevel level,
+                              int code) const {
+    return FindInMap(exposures_, GetExposureKey(id, level, code));
+  }
+  // copy of the sub account's position book, of all sub accounts if id is 0,
+  // marked at latest prices, at average price before the first mark
+  PositionBook GetBook(SubAccount::IdType id = 0);
 
  private:
-  // holding the sql session exclusively for position update
-  std::unique_ptr<soci::session> sql_;
+  // sub account positions of one security, append only, elements never move
+  struct PnlSecurity {
+    const Security* sec = nullptr;
+    std::atomic<double> price = 0;
+    tbb::concurrent_vector<PnlPosition> positions;
+  };
+  void UpdatePnl(PnlSecurity* sec);
+  void AddPnlPosition(const Security& sec, SubAccount::IdType id,
+                      Position* pos);
+  // re-mark position at price, and push the pnl and exposure changes since
+  // pos0 into account aggregates
+  static void Mark(const PnlPosition& p, double price, const Position& pos0);
+  static uint64_t GetExposureKey(SubAccount::IdType id, GicsLevel level,
+                                 int code) {
+    return (static_cast<uint64_t>(id) << 40) |
+           (static_cast<uint64_t>(level) << 32) | static_cast<uint32_t>(code);
+  }
+
+  // apply func on the sub account, broker account and user positions of the
+  // order along with their position values, on_sub_position is called with
+  // the updated sub account position while still holding its lock
+  template <typename Func, typename Func2 = void (*)(const Position&)>
+  void Update(const Order& ord, Func func,
+              Func2 on_sub_position = [](const Position&) {});
+  // log sub account position after a fill, replicated to database later
+  void Persist(const Confirmation::Ptr& cm, const Position& pos);
+
+ private:
+  std::unique_ptr<PositionWal> wal_;
   boost::unordered_map<std::pair<SubAccount::IdType, Security::IdType>, Bod>
       bods_;
   tbb::concurrent_unordered_map<std::pair<SubAccount::IdType, Security::IdType>,
@@ -71,12 +181,11 @@ class PositionManager : public Singleton<PositionManager> {
   tbb::concurrent_unordered_map<std::pair<User::IdType, Security::IdType>,
                                 Position>
       user_positions_;
-  struct Pnl {
-    double realized = 0;
-    double unrealized = 0;
-    std::ofstream* of = nullptr;
-  };
-  tbb::concurrent_unordered_map<SubAccount::IdType, Pnl> pnls_;
+  // maintained incrementally, guarded by the sub account mutex
+  tbb::concurrent_unordered_map<SubAccount::IdType, SubAccountPnl> pnls_;
+  tbb::concurrent_unordered_map<uint64_t, Exposure> exposures_;
+  SegmentedArray<std::atomic<PnlSecurity*>> pnl_securities_;
+  std::atomic<bool> pnl_started_ = false;
   std::string session_;
   friend class RiskMananger;
   friend class Connection;
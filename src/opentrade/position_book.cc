@@ -0,0 +1,134 @@
+#include "position_book.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include <cmath>
+
+namespace opentrade {
+
+size_t PositionBook::Add(const Security& sec, double qty, double avg_price,
+                         double price) {
+  if (n_ == qty_.size()) {
+    auto n = n_ + kLanes;
+    qty_.resize(n);
+    avg_price_.resize(n);
+    multiplier_.resize(n);
+    price_.resize(n);
+    sector_.resize(n);
+  }
+  qty_[n_] = qty;
+  avg_price_[n_] = avg_price;
+  multiplier_[n_] = sec.multiplier * sec.rate;
+  price_[n_] = price;
+  sector_[n_] = sec.sector;
+  return n_++;
+}
+
+void PositionBook::Append(const PositionBook& other) {
+  auto n = n_ + other.n_;
+  n = (n + kLanes - 1) / kLanes * kLanes;
+  qty_.resize(n_);
+  avg_price_.resize(n_);
+  multiplier_.resize(n_);
+  price_.resize(n_);
+  sector_.resize(n_);
+  auto m = other.n_;
+  qty_.insert(qty_.end(), other.qty_.begin(), other.qty_.begin() + m);
+  avg_price_.insert(avg_price_.end(), other.avg_price_.begin(),
+                    other.avg_price_.begin() + m);
+  multiplier_.insert(multiplier_.end(), other.multiplier_.begin(),
+                     other.multiplier_.begin() + m);
+  price_.insert(price_.end(), other.price_.begin(), other.price_.begin() + m);
+  sector_.insert(sector_.end(), other.sector_.begin(),
+                 other.sector_.begin() + m);
+  n_ += m;
+  qty_.resize(n);
+  avg_price_.resize(n);
+  multiplier_.resize(n);
+  price_.resize(n);
+  sector_.resize(n);
+}
+
+// value[i] = qty[i] * price[i] * shock * multiplier[i], optional
+static inline PositionBook::Totals Compute(size_t n, const double* qty,
+                                           const double* avg_price,
+                                           const double* multiplier,
+                                           const double* price, double shock,
+                                           double* value) {
+  PositionBook::Totals out;
+  auto i = 0u;
+#if defined(__AVX512F__)
+  auto s = _mm512_set1_pd(shock);
+  auto upnl = _mm512_setzero_pd();
+  auto gross = _mm512_setzero_pd();
+  auto net = _mm512_setzero_pd();
+  for (; i + 8 <= n; i += 8) {
+    auto qm = _mm512_mul_pd(_mm512_loadu_pd(qty + i),
+                            _mm512_loadu_pd(multiplier + i));
+    auto px = _mm512_mul_pd(_mm512_loadu_pd(price + i), s);
+    auto v = _mm512_mul_pd(qm, px);
+    auto avg = _mm512_loadu_pd(avg_price + i);
+    upnl = _mm512_add_pd(upnl, _mm512_mul_pd(qm, _mm512_sub_pd(px, avg)));
+    net = _mm512_add_pd(net, v);
+    gross = _mm512_add_pd(gross, _mm512_abs_pd(v));
+    if (value) _mm512_storeu_pd(value + i, v);
+  }
+  out.unrealized_pnl = _mm512_reduce_add_pd(upnl);
+  out.gross_exposure = _mm512_reduce_add_pd(gross);
+  out.net_exposure = _mm512_reduce_add_pd(net);
+#elif defined(__AVX2__)
+  auto s = _mm256_set1_pd(shock);
+  auto sign = _mm256_set1_pd(-0.);
+  auto upnl = _mm256_setzero_pd();
+  auto gross = _mm256_setzero_pd();
+  auto net = _mm256_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    auto qm = _mm256_mul_pd(_mm256_loadu_pd(qty + i),
+                            _mm256_loadu_pd(multiplier + i));
+    auto px = _mm256_mul_pd(_mm256_loadu_pd(price + i), s);
+    auto v = _mm256_mul_pd(qm, px);
+    auto avg = _mm256_loadu_pd(avg_price + i);
+    upnl = _mm256_add_pd(upnl, _mm256_mul_pd(qm, _mm256_sub_pd(px, avg)));
+    net = _mm256_add_pd(net, v);
+    gross = _mm256_add_pd(gross, _mm256_andnot_pd(sign, v));
+    if (value) _mm256_storeu_pd(value + i, v);
+  }
+  double tmp[4];
+  _mm256_storeu_pd(tmp, upnl);
+  out.unrealized_pnl = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+  _mm256_storeu_pd(tmp, gross);
+  out.gross_exposure = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+  _mm256_storeu_pd(tmp, net);
+  out.net_exposure = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+#endif
+  for (; i < n; ++i) {
+    auto qm = qty[i] * multiplier[i];
+    auto px = price[i] * shock;
+    auto v = qm * px;
+    out.unrealized_pnl += qm * (px - avg_price[i]);
+    out.net_exposure += v;
+    out.gross_exposure += std::abs(v);
+    if (value) value[i] = v;
+  }
+  return out;
+}
+
+PositionBook::Totals PositionBook::Compute(double price_shock) const {
+  return opentrade::Compute(qty_.size(), qty_.data(), avg_price_.data(),
+                            multiplier_.data(), price_.data(), 1 + price_shock,
+                            nullptr);
+}
+
+std::map<int, double> PositionBook::GetSectorExposure(
+    double price_shock) const {
+  std::vector<double> value(qty_.size());
+  opentrade::Compute(qty_.size(), qty_.data(), avg_price_.data(),
+                     multiplier_.data(), price_.data(), 1 + price_shock,
+                     value.data());
+  std::map<int, double> out;
+  for (auto i = 0u; i < n_; ++i) out[sector_[i]] += value[i];
+  return out;
+}
+
+}  // namespace opentrade
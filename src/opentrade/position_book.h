@@ -0,0 +1,55 @@
+#ifndef OPENTRADE_POSITION_BOOK_H_
+#define OPENTRADE_POSITION_BOOK_H_
+
+#include <map>
+#include <vector>
+
+#include "security.h"
+
+namespace opentrade {
+
+// Structure-of-arrays store of positions for bulk computations, e.g. end of
+// day marks, what-if scenarios and risk sweeps. Columns are padded with zero
+// quantity to a multiple of kLanes, so that the SIMD kernels (AVX-512 or AVX2
+// when compiled with -DNATIVE=ON, otherwise scalar) need no tail loop.
+// All values are in account currency, i.e. with multiplier * rate applied.
+// Rows are updated in place, PositionManager keeps one book per sub account
+// current on every fill and mark.
+class PositionBook {
+ public:
+  static const size_t kLanes = 8;
+
+  struct Totals {
+    double unrealized_pnl = 0;
+    double gross_exposure = 0;  // sum of |qty * price|
+    double net_exposure = 0;    // sum of qty * price
+  };
+
+  // returns the row index
+  size_t Add(const Security& sec, double qty, double avg_price, double price);
+  // price is kept if not positive
+  void Set(size_t i, double qty, double avg_price, double price) {
+    qty_[i] = qty;
+    avg_price_[i] = avg_price;
+    if (price > 0) price_[i] = price;
+  }
+  void Append(const PositionBook& other);
+  size_t size() const { return n_; }
+  // price_shock: relative price change applied to all positions, e.g. -0.1
+  // for a 10% drop
+  Totals Compute(double price_shock = 0) const;
+  // net exposure per GICS sector
+  std::map<int, double> GetSectorExposure(double price_shock = 0) const;
+
+ private:
+  size_t n_ = 0;
+  std::vector<double> qty_;
+  std::vector<double> avg_price_;
+  std::vector<double> multiplier_;  // multiplier * rate
+  std::vector<double> price_;
+  std::vector<int> sector_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_POSITION_BOOK_H_
@@ -0,0 +1,289 @@
+#include "position_wal.h"
+
+#include <fcntl.h>
+#include <postgresql/soci-postgresql.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "logger.h"
+
+namespace fs = boost::filesystem;
+
+namespace opentrade {
+
+static auto kStorePath = fs::path(".") / "store";
+static const char kPrefix[] = "positions-";
+
+// rows per insert statement
+static const size_t kRowsPerInsert = 1000;
+static const int kMaxBackoffMs = 30000;
+
+// "positions-YYYYMMDDHHMMSS" of session "YYYY-MM-DD HH:MM:SS"
+static std::string GetName(const std::string& session) {
+  std::string name = kPrefix;
+  for (auto c : session) {
+    if (isdigit(c)) name += c;
+  }
+  return name;
+}
+
+// escaped string literal, independent of standard_conforming_strings
+static std::string Quote(const char* str, size_t n) {
+  std::string out = "E'";
+  for (auto i = 0u; i < n; ++i) {
+    auto c = str[i];
+    if (c == '\'' || c == '\\') out += c;
+    out += c;
+  }
+  out += '\'';
+  return out;
+}
+
+// logs of sessions before the given one, oldest first
+static std::vector<fs::path> GetEarlierFiles(const std::string& name) {
+  std::vector<fs::path> out;
+  if (!fs::exists(kStorePath)) return out;
+  for (auto& entry : fs::directory_iterator(kStorePath)) {
+    auto fn = entry.path().filename().string();
+    if (fn.find(kPrefix) == 0 && fn < name) out.push_back(entry.path());
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+PositionWal::PositionWal(std::unique_ptr<soci::session> sql,
+                         const std::string& session, int flush_interval_ms,
+                         size_t batch_size)
+    : sql_(std::move(sql)),
+      flush_interval_ms_(flush_interval_ms),
+      batch_size_(batch_size) {
+  auto name = GetName(session);
+  for (auto& path : GetEarlierFiles(name)) {
+    files_.emplace_back();
+    files_.back().path = path;
+    files_.back().name = path.filename().string();
+  }
+  auto path = kStorePath / name;
+  int64_t n = 0;
+  if (fs::exists(path)) {
+    auto size = fs::file_size(path);
+    n = size / sizeof(PositionRecord);
+    if (size % sizeof(PositionRecord)) {
+      LOG_ERROR("Truncated partial record at the end of " << path);
+      fs::resize_file(path, n * sizeof(PositionRecord));
+    }
+  }
+  num_written_ = n;
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0) {
+    LOG_FATAL("Failed to write file: " << path << ": " << strerror(errno));
+  }
+  files_.emplace_back();
+  files_.back().path = path;
+  files_.back().name = name;
+  LOG_INFO("Position WAL: " << path << ", " << n << " records, "
+                            << files_.size() - 1
+                            << " earlier session(s) to replicate");
+  writer_ = std::thread([this]() { RunWriter(); });
+  thread_ = std::thread([this]() { Run(); });
+}
+
+PositionWal::~PositionWal() {
+  {
+    std::lock_guard<std::mutex> lock(writer_m_);
+    stop_writer_ = true;
+  }
+  writer_cv_.notify_one();
+  writer_.join();
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+  ::close(fd_);
+}
+
+// called with the position's account lock held, which keeps rows of one
+// account in order, hence no IO here
+void PositionWal::Append(const PositionRecord& rec) {
+  {
+    std::lock_guard<std::mutex> lock(writer_m_);
+    queued_.push_back(rec);
+  }
+  writer_cv_.notify_one();
+}
+
+static bool WriteAll(int fd, const char* p, size_t n) {
+  while (n) {
+    auto m = ::write(fd, p, n);
+    if (m < 0 && errno == EINTR) continue;
+    if (m <= 0) return false;
+    p += m;
+    n -= m;
+  }
+  return true;
+}
+
+void PositionWal::RunWriter() {
+  std::vector<PositionRecord> recs;
+  auto backoff = 0;
+  auto stopping = false;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(writer_m_);
+      // recs is not empty only if the last write failed
+      writer_cv_.wait(lock, [&]() {
+        return stop_writer_ || !queued_.empty() || !recs.empty();
+      });
+      stopping = stop_writer_;
+      if (stopping && queued_.empty() && recs.empty()) break;
+      recs.insert(recs.end(), queued_.begin(), queued_.end());
+      queued_.clear();
+    }
+    if (recs.empty()) continue;
+    if (!WriteAll(fd_, reinterpret_cast<const char*>(recs.data()),
+                  recs.size() * sizeof(PositionRecord)) ||
+        fdatasync(fd_)) {
+      LOG_ERROR("Failed to append position WAL: " << strerror(errno));
+      // drop the partial write, the whole batch is written again
+      if (ftruncate(fd_, num_written_ * sizeof(PositionRecord)))
+        LOG_ERROR("Failed to truncate position WAL: " << strerror(errno));
+      if (stopping) {
+        LOG_ERROR(recs.size() << " position records lost on exit");
+        break;
+      }
+      backoff = std::min(backoff ? backoff * 2 : 100, kMaxBackoffMs);
+      std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+      continue;
+    }
+    backoff = 0;
+    auto n0 = num_written_.load();
+    num_written_ += recs.size();
+    if (n0 / batch_size_ != num_written_ / batch_size_) cv_.notify_one();
+    recs.clear();
+  }
+}
+
+PositionWal::LastRecords PositionWal::LoadEarlierSessions(
+    const std::string& session) {
+  LastRecords out;
+  for (auto& path : GetEarlierFiles(GetName(session))) {
+    std::ifstream ifs(path.c_str(), std::ifstream::binary);
+    PositionRecord rec;
+    while (ifs.read(reinterpret_cast<char*>(&rec), sizeof(rec))) {
+      out[std::make_pair(rec.sub_account_id, rec.security_id)] = rec;
+    }
+  }
+  return out;
+}
+
+void PositionWal::Run() {
+  auto backoff = 0;
+  auto stopping = false;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_);
+      if (stop_) break;
+      auto ms = backoff ? backoff : flush_interval_ms_;
+      cv_.wait_for(lock, std::chrono::milliseconds(ms));
+      if (stop_) break;
+    }
+    if (Replicate()) {
+      backoff = 0;
+      continue;
+    }
+    backoff = std::min(backoff ? backoff * 2 : flush_interval_ms_ + 1000,
+                       kMaxBackoffMs);
+    try {
+      sql_->reconnect();
+    } catch (const soci::soci_error& e) {
+      LOG_ERROR("Failed to reconnect database: " << e.what());
+    }
+  }
+  Replicate();  // best effort, the rest is done on next start
+}
+
+bool PositionWal::Replicate() {
+  std::vector<PositionRecord> recs;
+  while (!files_.empty()) {
+    auto& f = files_.front();
+    auto is_current = files_.size() == 1;
+    try {
+      if (f.seq < 0) {
+        int64_t seq = 0;
+        *sql_ << "select seq from position_wal where \"name\" = :name",
+            soci::into(seq), soci::use(f.name);
+        f.seq = seq;
+      }
+      int64_t n = is_current ? num_written_.load()
+                             : fs::file_size(f.path) / sizeof(PositionRecord);
+      if (f.seq >= n) {
+        if (is_current) return true;
+        f.ifs.close();
+        fs::remove(f.path);
+        LOG_INFO("Position WAL " << f.name << " fully replicated, removed");
+        files_.pop_front();
+        continue;
+      }
+      auto m = std::min<int64_t>(n - f.seq, batch_size_);
+      recs.resize(m);
+      if (!f.ifs.is_open()) f.ifs.open(f.path.c_str(), std::ifstream::binary);
+      f.ifs.clear();
+      f.ifs.seekg(f.seq * sizeof(PositionRecord));
+      if (!f.ifs.read(reinterpret_cast<char*>(recs.data()),
+                      m * sizeof(PositionRecord))) {
+        LOG_ERROR("Failed to read position WAL " << f.path);
+        return false;
+      }
+      Write(f, recs.data(), m);
+      f.seq += m;
+    } catch (const soci::postgresql_soci_error& e) {
+      LOG_ERROR("Failed to replicate position WAL " << f.name << ": \n"
+                                                    << e.sqlstate() << ' '
+                                                    << e.what());
+      return false;
+    } catch (const soci::soci_error& e) {
+      LOG_ERROR("Failed to replicate position WAL " << f.name << ": \n"
+                                                    << e.what());
+      return false;
+    }
+  }
+  return true;
+}
+
+void PositionWal::Write(const File& file, const PositionRecord* recs,
+                        size_t n) {
+  soci::transaction tr(*sql_);
+  for (auto i = 0u; i < n; i += kRowsPerInsert) {
+    std::stringstream os;
+    os << R"(
+      insert into position(user_id, sub_account_id, security_id,
+      broker_account_id, qty, avg_price, realized_pnl, tm, "desc") values)";
+    auto end = std::min(n, i + kRowsPerInsert);
+    for (auto j = i; j < end; ++j) {
+      auto& r = recs[j];
+      if (j > i) os << ',';
+      os << std::defaultfloat << std::setprecision(15) << '(' << r.user_id
+         << ',' << r.sub_account_id << ',' << r.security_id << ','
+         << r.broker_account_id << ',' << r.qty << ',' << r.avg_price << ','
+         << r.realized_pnl << ",to_timestamp(" << std::fixed
+         << std::setprecision(6) << r.tm / 1e6 << ") at time zone 'utc',"
+         << Quote(r.desc, strnlen(r.desc, sizeof(r.desc))) << ')';
+    }
+    *sql_ << os.str();
+  }
+  auto name = file.name;
+  int64_t seq = file.seq + n;
+  *sql_ << R"(
+    insert into position_wal("name", seq) values(:name, :seq)
+    on conflict("name") do update set seq = excluded.seq
+  )",
+      soci::use(name), soci::use(seq);
+  tr.commit();
+}
+
+}  // namespace opentrade
@@ -0,0 +1,95 @@
+#ifndef OPENTRADE_POSITION_WAL_H_
+#define OPENTRADE_POSITION_WAL_H_
+
+#include <soci.h>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "account.h"
+#include "security.h"
+
+namespace opentrade {
+
+// fixed size record of position WAL
+#pragma pack(push, 1)
+struct PositionRecord {
+  int64_t tm = 0;  // utc in microseconds
+  double qty = 0;
+  double avg_price = 0;
+  double realized_pnl = 0;
+  Security::IdType security_id = 0;
+  User::IdType user_id = 0;
+  SubAccount::IdType sub_account_id = 0;
+  BrokerAccount::IdType broker_account_id = 0;
+  char desc[128] = "";
+};
+#pragma pack(pop)
+
+// Local append-only log of position rows, one file per session under store/.
+// It is the authoritative intraday record. Append() only queues the row in
+// memory, a writer thread appends whatever is queued to the file and
+// fdatasyncs it (group commit), so a fill's row is on local disk one write
+// and sync after Append() returns, and rows queued meanwhile share the next
+// sync. Another thread replicates the synced part of the logs into database
+// table position in order, every flush_interval_ms or once batch_size rows
+// are pending. The number of replicated records of each log is saved in table
+// position_wal within the same transaction as the rows, so that replication
+// resumes exactly where it stopped after a restart. Database errors are
+// retried with backoff and never block Append().
+class PositionWal {
+ public:
+  typedef std::map<std::pair<SubAccount::IdType, Security::IdType>,
+                   PositionRecord>
+      LastRecords;
+
+  PositionWal(std::unique_ptr<soci::session> sql, const std::string& session,
+              int flush_interval_ms, size_t batch_size);
+  ~PositionWal();
+  void Append(const PositionRecord& rec);
+  // last record of each sub account position in logs of earlier sessions,
+  // some of which may not have reached database yet
+  static LastRecords LoadEarlierSessions(const std::string& session);
+
+ private:
+  struct File {
+    boost::filesystem::path path;
+    std::string name;
+    std::ifstream ifs;
+    int64_t seq = -1;  // replicated records, -1 before loaded from database
+  };
+  void Run();
+  void RunWriter();
+  bool Replicate();
+  void Write(const File& file, const PositionRecord* recs, size_t n);
+
+ private:
+  std::unique_ptr<soci::session> sql_;
+  const int flush_interval_ms_;
+  const size_t batch_size_;
+  int fd_ = -1;
+  std::atomic<int64_t> num_written_ = 0;  // synced records of current session
+  std::deque<File> files_;                // current session is the last
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::thread thread_;
+  // rows appended but not written yet
+  std::vector<PositionRecord> queued_;
+  std::mutex writer_m_;
+  std::condition_variable writer_cv_;
+  bool stop_writer_ = false;
+  std::thread writer_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_POSITION_WAL_H_
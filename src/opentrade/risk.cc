@@ -1,37 +1,141 @@
 #include "risk.h"
 
+#include <tbb/concurrent_unordered_map.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "market_data.h"
 #include "position.h"
 
 namespace opentrade {
 
+static inline double GetBurst(double burst, double rate) {
+  return burst > 0 ? burst : rate;
+}
+
+// n_prior(_security): messages of the same batch to be sent before this one
 static bool CheckMsgRate(const char* name, const AccountBase& acc,
-                         Security::IdType sid) {
-  auto tm = time(nullptr);
+                         Security::IdType sid, int n_prior = 0,
+                         int n_prior_security = 0) {
+  auto now = NowInNano();
   auto& l = acc.limits;
   if (l.msg_rate_per_security > 0) {
-    auto v = FindInMap(acc.throttle_per_security_in_sec, sid)(tm);
-    if (v >= l.msg_rate_per_security) {
+    auto throttle = acc.GetThrottle(sid);
+    auto burst =
+        GetBurst(l.msg_burst_per_security, l.msg_rate_per_security);
+    if (throttle ? !throttle->Check(now, l.msg_rate_per_security,
+                                    burst - n_prior_security)
+                 : n_prior_security + 1 > burst) {
       char buf[256];
       snprintf(buf, sizeof(buf),
-               "%s limit breach: message rate per second %d > %f", name, v,
-               l.msg_rate_per_security);
+               "%s limit breach: message rate per security %f/s, burst %f",
+               name, l.msg_rate_per_security, burst);
       kRiskError = buf;
       return false;
     }
   }
-  if (l.msg_rate > 0 && acc.throttle_in_sec(tm) >= l.msg_rate) {
-    char buf[256];
-    snprintf(buf, sizeof(buf), "%s limit breach: message rate %d > %f", name,
-             acc.throttle_in_sec(tm), l.msg_rate);
-    kRiskError = buf;
+  if (l.msg_rate > 0) {
+    auto burst = GetBurst(l.msg_burst, l.msg_rate);
+    if (!acc.throttle.Check(now, l.msg_rate, burst - n_prior)) {
+      char buf[256];
+      snprintf(buf, sizeof(buf),
+               "%s limit breach: message rate %f/s, burst %f", name,
+               l.msg_rate, burst);
+      kRiskError = buf;
+      return false;
+    }
+  }
+  return true;
+}
+
+static int64_t GetMsgRateWait(const AccountBase& acc, Security::IdType sid,
+                              int64_t now) {
+  auto& l = acc.limits;
+  int64_t wait = 0;
+  if (l.msg_rate > 0)
+    wait = acc.throttle.GetWait(now, l.msg_rate,
+                                GetBurst(l.msg_burst, l.msg_rate));
+  if (l.msg_rate_per_security > 0) {
+    auto throttle = acc.GetThrottle(sid);
+    if (throttle)
+      wait = std::max(
+          wait, throttle->GetWait(now, l.msg_rate_per_security,
+                                  GetBurst(l.msg_burst_per_security,
+                                           l.msg_rate_per_security)));
+  }
+  return wait;
+}
+
+// Reservations are keyed by scope, account id and a 40-bit sub key, which is
+// the security id, kAccountTotal or GICS level << 32 | code.
+enum ReservationScope {
+  kSubAccountScope,
+  kBrokerAccountScope,
+  kUserScope,
+  kSubAccountGicsScope,
+};
+
+static const uint64_t kAccountTotal = 1ull << 39;
+
+static inline uint64_t GetReservationKey(ReservationScope scope, uint32_t id,
+                                         uint64_t sub_key) {
+  return (static_cast<uint64_t>(scope) << 56) |
+         (static_cast<uint64_t>(id) << 40) | sub_key;
+}
+
+static tbb::concurrent_unordered_map<uint64_t, Reservation> kReservationMap;
+
+// returns the value before
+static inline double FetchAdd(std::atomic<double>* a, double v) {
+  auto v0 = a->load(std::memory_order_relaxed);
+  while (!a->compare_exchange_weak(v0, v0 + v, std::memory_order_acq_rel)) {
+  }
+  return v0;
+}
+
+// Claim value v on reservation of key if check(in_flight) passes, in_flight
+// being the value of other orders which passed risk but are not outstanding
+// yet. check must read positions, see Reservation.
+template <typename Func>
+static bool Reserve(uint64_t key, double v, Reservations* out, Func check) {
+  auto& r = kReservationMap[key];
+  auto in_flight = FetchAdd(&r.in_flight, v);
+  if (!check(in_flight)) {
+    FetchAdd(&r.in_flight, -v);
     return false;
   }
+  out->emplace_back(&r, v);
   return true;
 }
 
-static bool Check(const char* name, const Order& ord, const AccountBase& acc,
-                  const Position& pos) {
-  if (!CheckMsgRate(name, acc, ord.sec->id)) return false;
+// value limit check of position value pos after order value v, in_flight
+// is added regardless of side to stay on the safe side
+static inline double GetValue(const Order& ord, const PositionValue& pos,
+                              double v, double in_flight) {
+  auto net = pos.total_bought - pos.total_sold;
+  if (ord.IsBuy())
+    return std::max(std::abs(net + pos.total_outstanding_buy + v),
+                    std::abs(net - pos.total_outstanding_sell)) +
+           in_flight;
+  return std::max(std::abs(net + pos.total_outstanding_buy),
+                  std::abs(net - pos.total_outstanding_sell - v)) +
+         in_flight;
+}
+
+static inline double GetTurnover(const PositionValue& pos, double v,
+                                 double in_flight) {
+  return pos.total_bought + pos.total_outstanding_buy + pos.total_sold +
+         pos.total_outstanding_sell + v + in_flight;
+}
+
+// checks not depending on positions
+static bool CheckOrder(const char* name, const Order& ord,
+                       const AccountBase& acc, bool check_msg_rate,
+                       int n_prior = 0, int n_prior_security = 0) {
+  if (check_msg_rate && !CheckMsgRate(name, acc, ord.sec->id, n_prior,
+                                      n_prior_security))
+    return false;
 
   auto& l = acc.limits;
   char buf[256];
@@ -55,75 +159,141 @@ static bool Check(const char* name, const Order& ord, const AccountBase& acc,
     }
   }
 
-  if (l.value > 0) {
-    double v2;
-    auto net = pos.total_bought - pos.total_sold;
-    if (ord.IsBuy())
-      v2 = std::max(std::abs(net + pos.total_outstanding_buy + v),
-                    std::abs(net - pos.total_outstanding_sell));
-    else
-      v2 = std::max(std::abs(net + pos.total_outstanding_buy),
-                    std::abs(net - pos.total_outstanding_sell - v));
-    if (v2 > l.value) {
-      snprintf(buf, sizeof(buf),
-               "%s limit breach: security intraday trade value %f > %f, "
-               "multiplier=%f, "
-               "currency rate=%f",
-               name, v2, l.value, ord.sec->multiplier, ord.sec->rate);
-      kRiskError = buf;
-      return false;
-    }
-  }
+  return true;
+}
 
-  if (l.turnover > 0) {
-    double v2 = pos.total_bought + pos.total_outstanding_buy + pos.total_sold +
-                pos.total_outstanding_sell + v;
-    if (v2 > l.turnover) {
-      snprintf(buf, sizeof(buf),
-               "%s limit breach: security intraday turnover %f > %f, "
-               "multiplier=%f, "
-               "currency rate=%f",
-               name, v2, l.turnover, ord.sec->multiplier, ord.sec->rate);
-      kRiskError = buf;
-      return false;
-    }
-  }
+template <typename GetPosition>
+static bool Check(const char* name, const Order& ord, const AccountBase& acc,
+                  ReservationScope scope, uint32_t id, bool check_msg_rate,
+                  Reservations* out, GetPosition get_position) {
+  if (!CheckOrder(name, ord, acc, check_msg_rate)) return false;
 
-  if (l.total_value > 0) {
-    double v2;
-    auto& pos = acc.position_value;
-    auto net = pos.total_bought - pos.total_sold;
-    if (ord.IsBuy())
-      v2 = std::max(std::abs(net + pos.total_outstanding_buy + v),
-                    std::abs(net - pos.total_outstanding_sell));
-    else
-      v2 = std::max(std::abs(net + pos.total_outstanding_buy),
-                    std::abs(net - pos.total_outstanding_sell - v));
-    if (v2 > l.total_value) {
-      snprintf(buf, sizeof(buf),
-               "%s limit breach: total intraday trade value %f > %f", name, v2,
-               l.total_value);
-      kRiskError = buf;
-      return false;
-    }
+  auto& l = acc.limits;
+  char buf[256];
+  auto v = ord.qty * ord.price * ord.sec->multiplier * ord.sec->rate;
+
+  if (l.value > 0 || l.turnover > 0) {
+    auto ok = Reserve(
+        GetReservationKey(scope, id, ord.sec->id), v, out,
+        [&](double in_flight) {
+          auto& pos = get_position();
+          if (l.value > 0) {
+            auto v2 = GetValue(ord, pos, v, in_flight);
+            if (v2 > l.value) {
+              snprintf(buf, sizeof(buf),
+                       "%s limit breach: security intraday trade value %f > "
+                       "%f, multiplier=%f, "
+                       "currency rate=%f",
+                       name, v2, l.value, ord.sec->multiplier, ord.sec->rate);
+              kRiskError = buf;
+              return false;
+            }
+          }
+          if (l.turnover > 0) {
+            auto v2 = GetTurnover(pos, v, in_flight);
+            if (v2 > l.turnover) {
+              snprintf(buf, sizeof(buf),
+                       "%s limit breach: security intraday turnover %f > %f, "
+                       "multiplier=%f, "
+                       "currency rate=%f",
+                       name, v2, l.turnover, ord.sec->multiplier,
+                       ord.sec->rate);
+              kRiskError = buf;
+              return false;
+            }
+          }
+          return true;
+        });
+    if (!ok) return false;
   }
 
-  if (l.total_turnover > 0) {
-    auto& pos = acc.position_value;
-    double v2 = pos.total_bought + pos.total_outstanding_buy + pos.total_sold +
-                pos.total_outstanding_sell + v;
-    if (v2 > l.total_turnover) {
-      snprintf(buf, sizeof(buf),
-               "%s limit breach: total intraday turnover %f > %f", name, v2,
-               l.total_turnover);
-      kRiskError = buf;
-      return false;
-    }
+  if (l.total_value > 0 || l.total_turnover > 0) {
+    auto ok = Reserve(
+        GetReservationKey(scope, id, kAccountTotal), v, out,
+        [&](double in_flight) {
+          auto& pos = acc.position_value;
+          if (l.total_value > 0) {
+            auto v2 = GetValue(ord, pos, v, in_flight);
+            if (v2 > l.total_value) {
+              snprintf(buf, sizeof(buf),
+                       "%s limit breach: total intraday trade value %f > %f",
+                       name, v2, l.total_value);
+              kRiskError = buf;
+              return false;
+            }
+          }
+          if (l.total_turnover > 0) {
+            auto v2 = GetTurnover(pos, v, in_flight);
+            if (v2 > l.total_turnover) {
+              snprintf(buf, sizeof(buf),
+                       "%s limit breach: total intraday turnover %f > %f",
+                       name, v2, l.total_turnover);
+              kRiskError = buf;
+              return false;
+            }
+          }
+          return true;
+        });
+    if (!ok) return false;
   }
 
   return true;
 }
 
+static const char* kGicsNames[kNumGicsLevels] = {
+    "sector",
+    "industry group",
+    "industry",
+    "sub industry",
+};
+
+static inline uint64_t GetGicsKey(SubAccount::IdType id, GicsLevel level,
+                                  int code) {
+  return GetReservationKey(
+      kSubAccountGicsScope, id,
+      (static_cast<uint64_t>(level) << 32) | static_cast<uint32_t>(code));
+}
+
+static bool CheckExposure(const Order& ord, Reservations* out) {
+  auto& l = ord.sub_account->limits;
+  const double limits[kNumGicsLevels] = {
+      l.sector_value,
+      l.industry_group_value,
+      l.industry_value,
+      l.sub_industry_value,
+  };
+  auto v = ord.qty * ord.price * ord.sec->multiplier * ord.sec->rate;
+  auto id = ord.sub_account->id;
+  for (auto i = 0; i < kNumGicsLevels; ++i) {
+    if (limits[i] <= 0) continue;
+    auto level = static_cast<GicsLevel>(i);
+    auto code = GetGicsCode(*ord.sec, level);
+    auto key = GetGicsKey(id, level, code);
+    auto ok = Reserve(key, v, out, [&](double in_flight) {
+      auto& e = PositionManager::Instance().GetExposure(id, level, code);
+      double v2;
+      if (ord.IsBuy())
+        v2 = std::max(std::abs(e.net + e.outstanding_buy + v),
+                      std::abs(e.net - e.outstanding_sell));
+      else
+        v2 = std::max(std::abs(e.net + e.outstanding_buy),
+                      std::abs(e.net - e.outstanding_sell - v));
+      v2 += in_flight;
+      if (v2 > limits[i]) {
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "sub_account limit breach: %s %d value %f > %f", kGicsNames[i],
+                 code, v2, limits[i]);
+        kRiskError = buf;
+        return false;
+      }
+      return true;
+    });
+    if (!ok) return false;
+  }
+  return true;
+}
+
 bool RiskManager::CheckMsgRate(const Order& ord) {
   assert(ord.sub_account);
   assert(ord.sec);
@@ -142,27 +312,383 @@ bool RiskManager::CheckMsgRate(const Order& ord) {
   return true;
 }
 
-bool RiskManager::Check(const Order& ord) {
+int64_t RiskManager::GetMsgRateWait(const Order& ord, int64_t now) const {
+  auto sid = ord.sec->id;
+  return std::max({opentrade::GetMsgRateWait(*ord.sub_account, sid, now),
+                   opentrade::GetMsgRateWait(*ord.broker_account, sid, now),
+                   opentrade::GetMsgRateWait(*ord.user, sid, now)});
+}
+
+bool RiskManager::Check(const Order& ord, bool check_msg_rate,
+                        Reservations* reservations) {
   assert(ord.sub_account);
   assert(ord.sec);
   assert(ord.user);
   assert(ord.broker_account);
 
-  if (!opentrade::Check(
-          "sub_account", ord, *ord.sub_account,
-          PositionManager::Instance().Get(*ord.sub_account, *ord.sec)))
+  if (!CheckPrice(ord)) return false;
+  Reservations tmp;
+  auto out = reservations ? reservations : &tmp;
+  auto n = out->size();
+  auto ok = CheckAll(ord, check_msg_rate, out);
+  if (!ok || !reservations) {
+    Reservations mine(out->begin() + n, out->end());
+    out->resize(n);
+    Settle(&mine);
+  }
+  return ok;
+}
+
+bool RiskManager::CheckAll(const Order& ord, bool check_msg_rate,
+                           Reservations* out) {
+  auto& pm = PositionManager::Instance();
+  auto& sec = *ord.sec;
+
+  auto& sub = *ord.sub_account;
+  if (!opentrade::Check("sub_account", ord, sub, kSubAccountScope, sub.id,
+                        check_msg_rate, out,
+                        [&]() -> auto& { return pm.Get(sub, sec); }))
     return false;
 
-  if (!opentrade::Check(
-          "broker_account", ord, *ord.broker_account,
-          PositionManager::Instance().Get(*ord.broker_account, *ord.sec)))
+  if (!CheckExposure(ord, out)) return false;
+
+  auto& broker = *ord.broker_account;
+  if (!opentrade::Check("broker_account", ord, broker, kBrokerAccountScope,
+                        broker.id, check_msg_rate, out,
+                        [&]() -> auto& { return pm.Get(broker, sec); }))
     return false;
 
-  if (!opentrade::Check("user", ord, *ord.user,
-                        PositionManager::Instance().Get(*ord.user, *ord.sec)))
+  auto& user = *ord.user;
+  if (!opentrade::Check("user", ord, user, kUserScope, user.id,
+                        check_msg_rate, out,
+                        [&]() -> auto& { return pm.Get(user, sec); }))
     return false;
 
   return true;
 }
 
+bool RiskManager::CheckPrice(const Order& ord) {
+  if (price_band_pct_ <= 0) return true;
+  if (ord.type != kLimit && ord.type != kStopLimit) return true;
+  double ref = 0, low = 0, high = 0, tick_size = 0;
+  auto band = price_bands_.Get(ord.sec->id);
+  if (band) {
+    uint32_t seq;
+    do {
+      seq = band->seq.load(std::memory_order_acquire);
+      ref = band->ref.load(std::memory_order_relaxed);
+      low = band->low.load(std::memory_order_relaxed);
+      high = band->high.load(std::memory_order_relaxed);
+      tick_size = band->tick_size.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != band->seq.load(std::memory_order_relaxed));
+  }
+  char buf[256];
+  if (low > 0 && (ord.price < low || ord.price > high)) {
+    snprintf(buf, sizeof(buf),
+             "Price %f out of band [%f, %f] around reference price %f",
+             ord.price, low, high, ref);
+    kRiskError = buf;
+    return false;
+  }
+  if (!tick_size) tick_size = ord.sec->GetTickSize(ord.price);
+  if (tick_size > 0) {
+    auto n = ord.price / tick_size;
+    if (std::abs(n - std::round(n)) > 1e-6) {
+      snprintf(buf, sizeof(buf), "Price %f is not multiple of tick size %f",
+               ord.price, tick_size);
+      kRiskError = buf;
+      return false;
+    }
+  }
+  return true;
+}
+
+void RiskManager::UpdatePriceBand(Security::IdType id, const MarketData& md) {
+  if (price_band_pct_ <= 0) return;
+  auto& q = md.quote();
+  auto ref = md.trade.close;
+  if (q.bid_price > 0 && q.ask_price > q.bid_price)
+    ref = (q.bid_price + q.ask_price) / 2;
+  if (ref <= 0) return;
+  auto& band = price_bands_[id];
+  if (ref == band.ref.load(std::memory_order_relaxed)) return;
+  if (!band.sec) band.sec = SecurityManager::Instance().Get(id);
+  auto sec = band.sec;
+  if (!sec) return;
+  auto low = ref * (1 - price_band_pct_);
+  auto high = ref * (1 + price_band_pct_);
+  auto tick_size = sec->GetTickSize(low);
+  if (tick_size != sec->GetTickSize(high)) tick_size = 0;
+  auto seq = band.seq.load(std::memory_order_relaxed);
+  band.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  band.ref.store(ref, std::memory_order_relaxed);
+  band.low.store(low, std::memory_order_relaxed);
+  band.high.store(high, std::memory_order_relaxed);
+  band.tick_size.store(tick_size, std::memory_order_relaxed);
+  band.seq.store(seq + 2, std::memory_order_release);
+}
+
+// One limit group of a batch, i.e. orders sharing a reservation key. kind is
+// kSecurityGroup, kTotalGroup or a GICS level.
+struct BatchItem {
+  uint64_t key;
+  uint32_t index;
+  int kind;
+  bool operator<(const BatchItem& b) const {
+    return key < b.key || (key == b.key && index < b.index);
+  }
+};
+
+static const int kSecurityGroup = -1;
+static const int kTotalGroup = -2;
+
+// what orders of a group are checked against, exposure is mapped into
+// PositionValue as bought = net
+struct BatchBase {
+  PositionValue pos;
+  double value = 0;
+  double turnover = 0;
+  const char* name = "";
+  std::string desc;
+};
+
+static const AccountBase& GetAccount(const Order& ord,
+                                     ReservationScope scope) {
+  switch (scope) {
+    case kBrokerAccountScope:
+      return *ord.broker_account;
+    case kUserScope:
+      return *ord.user;
+    default:
+      return *ord.sub_account;
+  }
+}
+
+static uint32_t GetAccountId(const Order& ord, ReservationScope scope) {
+  switch (scope) {
+    case kBrokerAccountScope:
+      return ord.broker_account->id;
+    case kUserScope:
+      return ord.user->id;
+    default:
+      return ord.sub_account->id;
+  }
+}
+
+static const char* kScopeNames[] = {"sub_account", "broker_account", "user",
+                                    "sub_account"};
+
+static BatchBase GetBatchBase(const BatchItem& item, const Order& ord) {
+  auto& pm = PositionManager::Instance();
+  auto scope = static_cast<ReservationScope>(item.key >> 56);
+  auto& l = GetAccount(ord, scope).limits;
+  BatchBase b;
+  b.name = kScopeNames[scope];
+  if (item.kind == kSecurityGroup) {
+    switch (scope) {
+      case kBrokerAccountScope:
+        b.pos = pm.Get(*ord.broker_account, *ord.sec);
+        break;
+      case kUserScope:
+        b.pos = pm.Get(*ord.user, *ord.sec);
+        break;
+      default:
+        b.pos = pm.Get(*ord.sub_account, *ord.sec);
+        break;
+    }
+    b.value = l.value;
+    b.turnover = l.turnover;
+    b.desc = "security intraday";
+  } else if (item.kind == kTotalGroup) {
+    b.pos = GetAccount(ord, scope).position_value;
+    b.value = l.total_value;
+    b.turnover = l.total_turnover;
+    b.desc = "total intraday";
+  } else {
+    auto level = static_cast<GicsLevel>(item.kind);
+    auto code = GetGicsCode(*ord.sec, level);
+    auto& e = pm.GetExposure(ord.sub_account->id, level, code);
+    b.pos.total_bought = e.net;
+    b.pos.total_outstanding_buy = e.outstanding_buy;
+    b.pos.total_outstanding_sell = e.outstanding_sell;
+    const double limits[kNumGicsLevels] = {
+        l.sector_value,
+        l.industry_group_value,
+        l.industry_value,
+        l.sub_industry_value,
+    };
+    b.value = limits[level];
+    b.desc = std::string(kGicsNames[level]) + ' ' + std::to_string(code);
+  }
+  return b;
+}
+
+size_t RiskManager::CheckBatch(const std::vector<Order*>& ords,
+                               std::vector<std::string>* errors,
+                               bool all_or_none, Reservations* reservations) {
+  Reservations tmp;
+  auto out = reservations ? reservations : &tmp;
+  auto n0 = out->size();
+  auto n = ords.size();
+  errors->resize(n);
+  std::vector<double> values(n);
+  std::vector<BatchItem> items;
+  items.reserve(n * 3);
+  // messages of the batch so far, keyed by account and account security
+  std::unordered_map<uint64_t, int> n_msgs;
+  static const ReservationScope kScopes[] = {kSubAccountScope,
+                                             kBrokerAccountScope, kUserScope};
+  for (auto i = 0u; i < n; ++i) {
+    auto& err = (*errors)[i];
+    auto& ord = *ords[i];
+    if (!err.empty() || ord.type == kOTC) continue;
+    kRiskError.clear();
+    if (!CheckPrice(ord)) {
+      err = kRiskError;
+      continue;
+    }
+    auto check_msg_rate = ord.sub_account->limits.msg_queue_ms <= 0;
+    auto ok = true;
+    for (auto scope : kScopes) {
+      auto& acc = GetAccount(ord, scope);
+      auto id = GetAccountId(ord, scope);
+      auto& n1 = n_msgs[GetReservationKey(scope, id, kAccountTotal)];
+      auto& n2 = n_msgs[GetReservationKey(scope, id, ord.sec->id)];
+      if (!CheckOrder(kScopeNames[scope], ord, acc, check_msg_rate, n1, n2)) {
+        ok = false;
+        break;
+      }
+      auto& l = acc.limits;
+      if (l.value > 0 || l.turnover > 0)
+        items.push_back({GetReservationKey(scope, id, ord.sec->id), i,
+                         kSecurityGroup});
+      if (l.total_value > 0 || l.total_turnover > 0)
+        items.push_back(
+            {GetReservationKey(scope, id, kAccountTotal), i, kTotalGroup});
+    }
+    if (!ok) {
+      err = kRiskError;
+      continue;
+    }
+    for (auto scope : kScopes) {
+      auto id = GetAccountId(ord, scope);
+      n_msgs[GetReservationKey(scope, id, kAccountTotal)]++;
+      n_msgs[GetReservationKey(scope, id, ord.sec->id)]++;
+    }
+    auto& l = ord.sub_account->limits;
+    const double limits[kNumGicsLevels] = {
+        l.sector_value,
+        l.industry_group_value,
+        l.industry_value,
+        l.sub_industry_value,
+    };
+    for (auto k = 0; k < kNumGicsLevels; ++k) {
+      if (limits[k] <= 0) continue;
+      auto level = static_cast<GicsLevel>(k);
+      items.push_back({GetGicsKey(ord.sub_account->id, level,
+                                  GetGicsCode(*ord.sec, level)),
+                       i, k});
+    }
+  }
+  for (auto i = 0u; i < n; ++i) {
+    if (!(*errors)[i].empty()) continue;
+    auto& ord = *ords[i];
+    values[i] = ord.qty * ord.price * ord.sec->multiplier * ord.sec->rate;
+  }
+
+  // Each group first claims the value of all its orders, then is evaluated
+  // in order sequence against its position plus the other in-flight value
+  // and the outstanding value of the group's earlier orders passed, and the
+  // value of the orders failed is taken back. An order failed in one group
+  // still counts in groups evaluated before, which errs on the safe side.
+  std::sort(items.begin(), items.end());
+  struct Failure {
+    uint32_t index;
+    const char* what;
+    double v;
+    double limit;
+  };
+  std::vector<Failure> failures;
+  for (auto b = 0u; b < items.size();) {
+    auto e = b + 1;
+    while (e < items.size() && items[e].key == items[b].key) ++e;
+    auto& r = kReservationMap[items[b].key];
+    double claimed = 0;
+    for (auto k = b; k < e; ++k) {
+      auto i = items[k].index;
+      if ((*errors)[i].empty()) claimed += values[i];
+    }
+    auto in_flight = FetchAdd(&r.in_flight, claimed);
+    failures.clear();
+    double total = 0;
+    auto base = GetBatchBase(items[b], *ords[items[b].index]);
+    auto pos = base.pos;
+    for (auto k = b; k < e; ++k) {
+      auto i = items[k].index;
+      if (!(*errors)[i].empty()) continue;
+      auto& ord = *ords[i];
+      auto v = values[i];
+      if (base.value > 0) {
+        auto v2 = GetValue(ord, pos, v, in_flight);
+        if (v2 > base.value) {
+          failures.push_back({i, "trade value", v2, base.value});
+          continue;
+        }
+      }
+      if (base.turnover > 0) {
+        auto v2 = GetTurnover(pos, v, in_flight);
+        if (v2 > base.turnover) {
+          failures.push_back({i, "turnover", v2, base.turnover});
+          continue;
+        }
+      }
+      if (ord.IsBuy())
+        pos.total_outstanding_buy += v;
+      else
+        pos.total_outstanding_sell += v;
+      total += v;
+    }
+    if (claimed != total) FetchAdd(&r.in_flight, total - claimed);
+    if (total) out->emplace_back(&r, total);
+    for (auto& f : failures) {
+      char buf[256];
+      snprintf(buf, sizeof(buf), "%s limit breach: %s %s %f > %f", base.name,
+               base.desc.c_str(), f.what, f.v, f.limit);
+      (*errors)[f.index] = buf;
+    }
+    b = e;
+  }
+
+  size_t npassed = 0;
+  const std::string* first_error = nullptr;
+  for (auto i = 0u; i < n; ++i) {
+    auto& err = (*errors)[i];
+    if (err.empty())
+      npassed++;
+    else if (!first_error)
+      first_error = &err;
+  }
+  if (all_or_none && first_error && npassed) {
+    auto err = "Basket rejected: " + *first_error;
+    for (auto& e : *errors) {
+      if (e.empty()) e = err;
+    }
+    npassed = 0;
+  }
+  if (!npassed || !reservations) {
+    Reservations mine(out->begin() + n0, out->end());
+    out->resize(n0);
+    Settle(&mine);
+  }
+  return npassed;
+}
+
+void RiskManager::Settle(Reservations* reservations) {
+  for (auto& pair : *reservations)
+    FetchAdd(&pair.first->in_flight, -pair.second);
+  reservations->clear();
+}
+
 }  // namespace opentrade
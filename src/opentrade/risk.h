@@ -1,19 +1,84 @@
 #ifndef OPENTRADE_RISK_H_
 #define OPENTRADE_RISK_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "order.h"
+#include "segmented_array.h"
 #include "utility.h"
 
 namespace opentrade {
 
 inline thread_local std::string kRiskError;
 
+// Value of orders which passed pre-trade risk on a position, but are not yet
+// added to its outstanding value. A check first adds the order value to
+// in_flight, then reads the position and checks it along with the in-flight
+// value found before its own, and takes its value back out if failed. Orders
+// are settled, i.e. taken out of in_flight, only after their outstanding
+// value is applied, so any check sees each earlier order either in flight or
+// in the position. Hence concurrent checks can not jointly breach a limit,
+// without any lock; at worst an order is rejected for another order's value
+// which is then rejected too.
+struct Reservation {
+  std::atomic<double> in_flight = 0;
+  Reservation() = default;
+  // for insertion into concurrent map only
+  Reservation(const Reservation&) {}
+};
+
+// values claimed by a check, to settle on any thread
+using Reservations = std::vector<std::pair<Reservation*, double>>;
+
+struct MarketData;
+
+// Price collar of a security around its reference price, i.e. mid of best
+// quote or else last price, precomputed on market data so that checking an
+// order price is a few compares. A seqlock keeps the fields consistent, there
+// is one writer per security, the market data thread of its primary source.
+struct PriceBand {
+  std::atomic<uint32_t> seq = 0;
+  std::atomic<double> ref = 0;
+  std::atomic<double> low = 0;
+  std::atomic<double> high = 0;
+  std::atomic<double> tick_size = 0;  // if the same across band, else 0
+  const Security* sec = nullptr;
+};
+
 class RiskManager : public Singleton<RiskManager> {
  public:
-  bool Check(const Order& ord);
+  // reserves the order value on the positions and accounts checked into
+  // reservations if passed, or only checks if reservations is null
+  bool Check(const Order& ord, bool check_msg_rate = true,
+             Reservations* reservations = nullptr);
+  // Check a basket in one pass, orders grouped by position and account, each
+  // group read once and reserved with one CAS, limits applied to the
+  // cumulative value of the batch in order sequence. (*errors)[i] is set for
+  // each order failed, orders coming with an error or of type OTC are
+  // skipped. If all_or_none, all fail once any fails. Returns the number of
+  // orders passed. Reserves as Check().
+  size_t CheckBatch(const std::vector<Order*>& ords,
+                    std::vector<std::string>* errors, bool all_or_none,
+                    Reservations* reservations = nullptr);
   bool CheckMsgRate(const Order& ord);
+  // nanoseconds until message rate limits allow one more message of the order
+  int64_t GetMsgRateWait(const Order& ord, int64_t now) const;
+  // limit price must be within ref * (1 +/- pct) and on tick, 0 to disable
+  void set_price_band_pct(double pct) { price_band_pct_ = pct; }
+  void UpdatePriceBand(Security::IdType id, const MarketData& md);
+  // settle and clear reservations, call once the orders' outstanding value
+  // has been applied, or the orders dropped
+  static void Settle(Reservations* reservations);
+
+ private:
+  bool CheckAll(const Order& ord, bool check_msg_rate, Reservations* out);
+  bool CheckPrice(const Order& ord);
+
+ private:
+  double price_band_pct_ = 0;
+  SegmentedArray<PriceBand> price_bands_;
 };
 
 }  // namespace opentrade
@@ -0,0 +1,135 @@
+#include "router.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "exchange_connectivity.h"
+#include "logger.h"
+
+namespace opentrade {
+
+static inline void UpdateEwma(std::atomic<double>* x, double v, double alpha) {
+  auto old = x->load(std::memory_order_relaxed);
+  while (!x->compare_exchange_weak(old, old + alpha * (v - old),
+                                   std::memory_order_relaxed)) {
+  }
+}
+
+void Router::Path::Add(int64_t latency, bool rejected) {
+  auto n = nsamples.fetch_add(1, std::memory_order_relaxed);
+  samples[n % kWindow].store(latency, std::memory_order_relaxed);
+  // plain average until there are enough samples
+  auto alpha = 1. / std::min<uint64_t>(n + 1, 32);
+  UpdateEwma(&mean, latency, alpha);
+  UpdateEwma(&reject_rate, rejected ? 1 : 0, alpha);
+  // every sample while few, then every 32, so that selection costs the
+  // placing thread nothing
+  if (n >= 64 && n % 32) return;
+  auto m = std::min<uint64_t>(n + 1, kWindow);
+  int64_t tmp[kWindow];
+  for (auto i = 0u; i < m; ++i)
+    tmp[i] = samples[i].load(std::memory_order_relaxed);
+  auto k = m * 99 / 100;
+  std::nth_element(tmp, tmp + k, tmp + m);
+  p99.store(tmp[k], std::memory_order_relaxed);
+}
+
+double Router::Path::ExpectedLatency() const {
+  auto depth = std::max(0, in_flight.load(std::memory_order_relaxed));
+  // one order at a time on a new path until its first ack
+  if (!nsamples.load(std::memory_order_relaxed) && depth)
+    return std::numeric_limits<double>::max();
+  auto rate = std::min(reject_rate.load(std::memory_order_relaxed), 0.99);
+  return (p99.load(std::memory_order_relaxed) +
+          depth * mean.load(std::memory_order_relaxed)) /
+         (1 - rate);
+}
+
+Router::Path* Router::GetPath(const ExchangeConnectivityAdapter* adapter) {
+  auto it = paths_.find(adapter);
+  if (it != paths_.end()) return it->second;
+  auto path = new Path;
+  auto res = paths_.emplace(adapter, path);
+  if (!res.second) delete path;
+  return res.first->second;
+}
+
+const Router::Candidates* Router::GetCandidates(const BrokerAccount& primary) {
+  auto& slot = candidates_[primary.id];
+  auto cands = slot.load(std::memory_order_acquire);
+  auto params = primary.params;
+  if (cands && cands->params == params) return cands;
+  auto tmp = new Candidates{params, {&primary}};
+  auto it = params->find("alternates");
+  if (it != params->end()) {
+    for (auto& name : Split(it->second, ", ")) {
+      auto acc = AccountManager::Instance().GetBrokerAccount(name);
+      if (!acc) {
+        LOG_WARN(primary.name << ": Unknown alternate broker account: "
+                              << name);
+        continue;
+      }
+      auto& accs = tmp->accounts;
+      if (std::find(accs.begin(), accs.end(), acc) == accs.end())
+        accs.push_back(acc);
+    }
+  }
+  // the replaced one is not released since other threads may still be
+  // reading it, intended memory leak as BrokerAccount::set_params
+  if (!slot.compare_exchange_strong(cands, tmp, std::memory_order_acq_rel)) {
+    delete tmp;
+    return cands;
+  }
+  return tmp;
+}
+
+const BrokerAccount* Router::Route(const BrokerAccount* primary) {
+  auto cands = GetCandidates(*primary);
+  if (cands->accounts.size() < 2) return primary;
+  const BrokerAccount* best = nullptr;
+  auto best_latency = 0.;
+  auto primary_latency = -1.;
+  for (auto acc : cands->accounts) {
+    auto adapter = acc->adapter;
+    if (!adapter) continue;
+    auto path = GetPath(adapter);
+    if (!adapter->connected()) {
+      // orders sent before disconnection may never be acked
+      path->reset_tm.store(NowInNano(), std::memory_order_relaxed);
+      path->in_flight.store(0, std::memory_order_relaxed);
+      continue;
+    }
+    auto latency = path->ExpectedLatency();
+    if (acc == primary) primary_latency = latency;
+    if (!best || latency < best_latency) {
+      best = acc;
+      best_latency = latency;
+    }
+  }
+  if (!best) return primary;
+  if (primary_latency >= 0 &&
+      primary_latency <= best_latency * (1 + kSwitchMargin))
+    return primary;
+  return best;
+}
+
+void Router::OnSent(const Order& ord) {
+  auto path = GetPath(ord.broker_account->adapter);
+  path->in_flight.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Router::OnAck(const Order& ord, OrderStatus exec_type) {
+  auto path = GetPath(ord.broker_account->adapter);
+  auto& t = ord.times;
+  if (t.send > path->reset_tm.load(std::memory_order_relaxed)) {
+    // never below 0, an order racing a reset may have been counted or not
+    auto n = path->in_flight.load(std::memory_order_relaxed);
+    while (n > 0 && !path->in_flight.compare_exchange_weak(
+                        n, n - 1, std::memory_order_relaxed)) {
+    }
+  }
+  path->Add(t.ack - t.send,
+            exec_type == kRejected || exec_type == kRiskRejected);
+}
+
+}  // namespace opentrade
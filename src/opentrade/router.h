@@ -0,0 +1,70 @@
+#ifndef OPENTRADE_ROUTER_H_
+#define OPENTRADE_ROUTER_H_
+
+#include <tbb/concurrent_unordered_map.h>
+#include <atomic>
+#include <vector>
+
+#include "account.h"
+#include "order.h"
+#include "segmented_array.h"
+#include "utility.h"
+
+namespace opentrade {
+
+// Chooses the broker account each order goes out through. A sub account maps
+// an exchange to one broker account, whose optional param "alternates" lists
+// other broker accounts (comma separated names) able to carry the same
+// orders, e.g. the same clearing account through another gateway.
+// Health of each adapter is measured online from the orders it carries:
+// p99 of ack latency over the last kWindow orders, reject rate and the
+// number of orders sent but not acked yet, all from the send and ack stamps
+// in Order::times. An order goes through the connected candidate with the
+// lowest expected latency, i.e. (p99 + in flight * mean) / (1 - reject rate);
+// the mapped account is kept unless another one beats it by kSwitchMargin,
+// so that equal paths do not flap.
+class Router : public Singleton<Router> {
+ public:
+  static constexpr int kWindow = 1024;
+  static constexpr double kSwitchMargin = 0.2;
+
+  // primary, i.e. the mapped account, if it has no alternates or none of
+  // them is connected
+  const BrokerAccount* Route(const BrokerAccount* primary);
+  // new order handed over to its adapter, ord.times.send stamped
+  void OnSent(const Order& ord);
+  // first confirmation of ord after sent, ord.times.ack stamped
+  void OnAck(const Order& ord, OrderStatus exec_type);
+
+ private:
+  struct Path {
+    std::atomic<int64_t> samples[kWindow] = {};  // ack latency in ns
+    std::atomic<uint64_t> nsamples = 0;
+    std::atomic<int64_t> p99 = 0;
+    std::atomic<double> mean = 0;
+    std::atomic<double> reject_rate = 0;
+    std::atomic<int> in_flight = 0;
+    // NowInNano() when in_flight was last cleared, orders sent before are
+    // not counted any more
+    std::atomic<int64_t> reset_tm = 0;
+
+    void Add(int64_t latency, bool rejected);
+    double ExpectedLatency() const;
+  };
+  struct Candidates {
+    const BrokerAccount::StrMap* params;
+    std::vector<const BrokerAccount*> accounts;  // the mapped one first
+  };
+
+  Path* GetPath(const ExchangeConnectivityAdapter* adapter);
+  const Candidates* GetCandidates(const BrokerAccount& primary);
+
+ private:
+  tbb::concurrent_unordered_map<const ExchangeConnectivityAdapter*, Path*>
+      paths_;
+  SegmentedArray<std::atomic<Candidates*>, 8> candidates_;  // by account id
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_ROUTER_H_
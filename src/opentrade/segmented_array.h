@@ -0,0 +1,65 @@
+#ifndef OPENTRADE_SEGMENTED_ARRAY_H_
+#define OPENTRADE_SEGMENTED_ARRAY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace opentrade {
+
+// Array directly indexed by uint32_t, e.g. order id or security id. Memory is
+// committed in segments of 2^kSegmentBits elements, allocated lock-free on
+// first write into the segment and never moved or released until destruction,
+// so that a lookup is just two dependent loads and references stay valid.
+// Elements are value-initialized.
+template <typename T, int kSegmentBits = 16>
+class SegmentedArray {
+ public:
+  static constexpr uint32_t kSegmentSize = 1u << kSegmentBits;
+  static constexpr size_t kNumSegments = (1ull << 32) >> kSegmentBits;
+
+  SegmentedArray() : dir_(new std::atomic<T*>[kNumSegments]()) {}
+  ~SegmentedArray() {
+    for (auto i = 0u; i < kNumSegments; ++i) delete[] dir_[i].load();
+  }
+  SegmentedArray(const SegmentedArray&) = delete;
+  SegmentedArray& operator=(const SegmentedArray&) = delete;
+
+  // nullptr if never written
+  T* Get(uint32_t i) const {
+    auto seg = dir_[i >> kSegmentBits].load(std::memory_order_acquire);
+    return seg ? seg + (i & (kSegmentSize - 1)) : nullptr;
+  }
+
+  T& operator[](uint32_t i) {
+    auto& slot = dir_[i >> kSegmentBits];
+    auto seg = slot.load(std::memory_order_acquire);
+    if (!seg) {
+      auto tmp = new T[kSegmentSize]();
+      if (slot.compare_exchange_strong(seg, tmp, std::memory_order_acq_rel)) {
+        seg = tmp;
+      } else {
+        delete[] tmp;  // lost the race, seg is the winner's segment now
+      }
+    }
+    return seg[i & (kSegmentSize - 1)];
+  }
+
+  // visit all elements of allocated segments, func(index, element)
+  template <typename Func>
+  void ForEach(Func func) const {
+    for (auto i = 0u; i < kNumSegments; ++i) {
+      auto seg = dir_[i].load(std::memory_order_acquire);
+      if (!seg) continue;
+      auto base = static_cast<uint32_t>(i) << kSegmentBits;
+      for (auto j = 0u; j < kSegmentSize; ++j) func(base + j, seg[j]);
+    }
+  }
+
+ private:
+  std::unique_ptr<std::atomic<T*>[]> dir_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_SEGMENTED_ARRAY_H_
@@ -53,7 +53,7 @@ struct WsSocketWrapper : public Transport {
   WsConnPtr ws_;
 };
 
-void Server::Publish(Confirmation::Ptr cm) {
+void Server::Publish(const Confirmation::Ptr& cm) {
   kIoService->post([cm]() {
     LockGuard lock(kMutex);
     for (auto& pair : kSocketMap) {
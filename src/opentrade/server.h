@@ -8,7 +8,7 @@ namespace opentrade {
 class Server {
  public:
   static void Start(int port, int nthreads = 1);
-  static void Publish(Confirmation::Ptr cm);
+  static void Publish(const Confirmation::Ptr& cm);
   static void Publish(const Algo& algo, const std::string& status,
                       const std::string& body, uint32_t seq);
   static void Stop();
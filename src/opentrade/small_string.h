@@ -0,0 +1,78 @@
+#ifndef OPENTRADE_SMALL_STRING_H_
+#define OPENTRADE_SMALL_STRING_H_
+
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace opentrade {
+
+// String with inline storage of N - 1 chars, only longer values go to heap
+template <size_t N>
+class SmallString {
+ public:
+  SmallString() { buf_[0] = 0; }
+  SmallString(const char* str) { assign(str, strlen(str)); }  // NOLINT
+  SmallString(std::string_view str) {                          // NOLINT
+    assign(str.data(), str.size());
+  }
+  SmallString(const std::string& str) {  // NOLINT
+    assign(str.data(), str.size());
+  }
+  SmallString(const SmallString& b) { assign(b.data(), b.size()); }
+
+  SmallString& operator=(const SmallString& b) {
+    if (this != &b) assign(b.data(), b.size());
+    return *this;
+  }
+  SmallString& operator=(const char* str) {
+    assign(str, strlen(str));
+    return *this;
+  }
+  SmallString& operator=(std::string_view str) {
+    assign(str.data(), str.size());
+    return *this;
+  }
+  SmallString& operator=(const std::string& str) {
+    assign(str.data(), str.size());
+    return *this;
+  }
+
+  const char* c_str() const { return heap_ ? heap_.get() : buf_; }
+  const char* data() const { return c_str(); }
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  std::string str() const { return std::string(c_str(), size_); }
+  operator std::string_view() const { return {c_str(), size_}; }
+
+ private:
+  void assign(const char* str, size_t n) {
+    if (n < N) {
+      memmove(buf_, str, n);
+      buf_[n] = 0;
+      heap_.reset();
+    } else {
+      std::unique_ptr<char[]> tmp(new char[n + 1]);
+      memcpy(tmp.get(), str, n);
+      tmp[n] = 0;
+      heap_ = std::move(tmp);
+    }
+    size_ = n;
+  }
+
+ private:
+  std::unique_ptr<char[]> heap_;
+  size_t size_ = 0;
+  char buf_[N];
+};
+
+template <size_t N>
+inline std::ostream& operator<<(std::ostream& os, const SmallString<N>& str) {
+  return os.write(str.data(), str.size());
+}
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_SMALL_STRING_H_
@@ -2,6 +2,9 @@
 #define OPENTRADE_UTILITY_H_
 
 #include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include <boost/algorithm/string.hpp>
 #include <cstring>
 #include <ctime>
@@ -55,6 +58,23 @@ static inline int64_t NowUtcInMicro() {
     return now.tv_sec * 1000000lu + now.tv_usec;
 }
 
+// monotonic, for measuring intervals only
+static inline int64_t NowInNano() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000l + now.tv_nsec;
+}
+
+// cpu timestamp counter, cheapest clock there is, only meaningful together
+// with a calibration against a real clock
+static inline uint64_t Rdtsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return NowInNano();
+#endif
+}
+
 static inline const char* GetNowStr() {
   struct timeval tp;
   gettimeofday(&tp, NULL);
@@ -26,24 +26,25 @@ class SimClient : public opentrade::Fix {
     OnCancelRejected(msg, id);
   }
 
-  std::string SetAndSend(const opentrade::Order& ord, FIX::Message* msg) {
-    SetTags(ord, msg);
-    msg->setField(FIX::Symbol(ord.sec->symbol));
-    msg->setField(FIX::ExDestination(ord.sec->exchange->name));
-    if (Send(msg))
-      return {};
-    else
-      return "Failed in FIX::Session::send()";
+  void SetSecurityTags(const opentrade::Security& sec,
+                       opentrade::FixSegment* seg) override {
+    Fix::SetSecurityTags(sec, seg);
+    seg->Add(FIX::FIELD::Symbol, sec.symbol);
+    seg->Add(FIX::FIELD::ExDestination, sec.exchange->name);
   }
 
   std::string Place(const opentrade::Order& ord) noexcept override {
-    FIX42::NewOrderSingle msg;
-    return SetAndSend(ord, &msg);
+    if (Send(ord))
+      return {};
+    else
+      return "Failed to send NewOrderSingle";
   }
 
   std::string Cancel(const opentrade::Order& ord) noexcept override {
-    FIX42::OrderCancelRequest msg;
-    return SetAndSend(ord, &msg);
+    if (Send(ord))
+      return {};
+    else
+      return "Failed to send OrderCancelRequest";
   }
 };
 
@@ -107,7 +107,7 @@ void SimServer::Start() noexcept {
 
   fix_settings_.reset(new FIX::SessionSettings(config_file));
   fix_store_factory_.reset(new FIX::NullStoreFactory());
-  fix_log_factory_.reset(new FIX::AsyncFileLogFactory(*fix_settings_));
+  fix_log_factory_.reset(new FIX::BinaryFileLogFactory(*fix_settings_));
   threaded_socket_acceptor_.reset(new FIX::ThreadedSocketAcceptor(
       *this, *fix_store_factory_, *fix_settings_, *fix_log_factory_));
   threaded_socket_acceptor_->start();
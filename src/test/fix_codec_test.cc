@@ -0,0 +1,154 @@
+// FixEncoder renders BodyLength, CheckSum, prices and timestamps as QuickFIX
+// does, ParseFixReport reads reports back including TransactTime.
+
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "fix/encoder.h"
+#include "fix/parser.h"
+#include "test.h"
+
+using namespace opentrade;
+
+static std::string Replace(std::string s) {
+  for (auto& c : s)
+    if (c == '|') c = '\x01';
+  return s;
+}
+
+// BodyLength and CheckSum computed the plain way
+static void CheckFraming(const std::string& msg) {
+  auto p = msg.find("\x01" "9=");
+  CHECK(p != std::string::npos);
+  auto body = msg.find('\x01', p + 1) + 1;
+  auto trailer = msg.rfind("10=");
+  CHECK(trailer != std::string::npos && msg[trailer - 1] == '\x01');
+  CHECK(std::stoul(msg.substr(p + 3, body - p - 4)) == trailer - body);
+  unsigned sum = 0;
+  for (auto i = 0u; i < trailer; ++i) sum += (uint8_t)msg[i];
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%03u", sum % 256);
+  CHECK(msg.substr(trailer) == std::string("10=") + buf + '\x01');
+}
+
+static std::string Price(double v) {
+  FixEncoder enc;
+  enc.Init("FIX.4.2", "S", "T");
+  enc.Begin("D");
+  enc.Add(44, v);
+  auto msg = enc.Finish(1, 0);
+  std::string s(msg.first, msg.second);
+  auto p = s.find("\x01" "44=") + 4;
+  return s.substr(p, s.find('\x01', p) - p);
+}
+
+static int64_t ToMicro(int y, int mon, int d, int h, int m, int s, int us) {
+  struct tm tm {};
+  tm.tm_year = y - 1900;
+  tm.tm_mon = mon - 1;
+  tm.tm_mday = d;
+  tm.tm_hour = h;
+  tm.tm_min = m;
+  tm.tm_sec = s;
+  return timegm(&tm) * 1000000ll + us;
+}
+
+int main() {
+  auto tm = ToMicro(2024, 2, 29, 23, 59, 58, 123456);
+
+  FixEncoder enc;
+  enc.Init("FIX.4.2", "SENDER", "TARGET");
+  FixSegment seg;
+  seg.Add(21, '1');
+  seg.Add(55, "IBM");
+  for (auto seq : {1, 9, 10, 99999}) {
+    enc.Begin("D");
+    enc.Add(11, int64_t(1234567));
+    enc.Add(38, 100.);
+    enc.Add(44, 12.5);
+    enc.Add(54, '1');
+    enc.AddTime(60, tm);
+    enc.Add(seg);
+    auto msg = enc.Finish(seq, tm);
+    std::string s(msg.first, msg.second);
+    CheckFraming(s);
+    CHECK(s.rfind(Replace("8=FIX.4.2|9="), 0) == 0);
+    auto body = s.substr(s.find('\x01', 12) + 1);
+    CHECK(body.rfind(Replace("35=D|49=SENDER|56=TARGET|34=") +
+                         std::to_string(seq) +
+                         Replace("|52=20240229-23:59:58.123|11=1234567|"
+                                 "38=100|44=12.5|54=1|"
+                                 "60=20240229-23:59:58.123|21=1|55=IBM|10="),
+                     0) == 0);
+  }
+
+  // body beyond kBufferSize is refused, not written past the buffer
+  std::string text(FixEncoder::kBufferSize, 'x');
+  enc.Begin("D");
+  enc.Add(11, int64_t(1));
+  CHECK(!enc.overflow());
+  enc.Add(58, text.data(), text.size());
+  CHECK(enc.overflow());
+  CHECK(!enc.Finish(1, tm).first);
+  FixSegment long_seg;
+  long_seg.Add(58, text);
+  enc.Begin("D");
+  enc.Add(long_seg);
+  CHECK(enc.overflow());
+  // a body filling kBufferSize exactly still gets its header and trailer
+  enc.Begin("D");
+  enc.Add(58, text.data(), text.size() - 4);
+  CHECK(!enc.overflow());
+  auto msg = enc.Finish(99999, tm);
+  CHECK(msg.first);
+  CheckFraming(std::string(msg.first, msg.second));
+  // CompIDs must leave room for the rest of the header
+  FixEncoder enc2;
+  CHECK(enc2.Init("FIX.4.2", std::string(70, 'S'), std::string(70, 'T')));
+  enc2.Begin("D");
+  enc2.Add(58, text.data(), text.size() - 4);
+  msg = enc2.Finish(INT64_MAX, tm);
+  CHECK(msg.first);
+  CheckFraming(std::string(msg.first, msg.second));
+  CHECK(!enc2.Init("FIX.4.2", std::string(100, 'S'), std::string(100, 'T')));
+
+  CHECK(Price(1) == "1");
+  CHECK(Price(0) == "0");
+  CHECK(Price(100.25) == "100.25");
+  CHECK(Price(0.1) == "0.1");
+  CHECK(Price(-2.5) == "-2.5");
+  CHECK(Price(123.456789) == "123.456789");
+  CHECK(Price(0.000000001) == "0.000000001");
+  CHECK(Price(0.9999999999) == "1");
+  CHECK(Price(1e12 + 0.5) == "1000000000000.5");
+
+  CHECK(ParseFixUtcTimestamp("20240229-23:59:58.123456") == tm);
+  CHECK(ParseFixUtcTimestamp("20240229-23:59:58.123") == tm - 456);
+  CHECK(ParseFixUtcTimestamp("20240229-23:59:58") == tm - 123456);
+  CHECK(ParseFixUtcTimestamp("19991231-00:00:01") ==
+        ToMicro(1999, 12, 31, 0, 0, 1, 0));
+  CHECK(ParseFixUtcTimestamp("21000301-12:00:00.5") ==
+        ToMicro(2100, 3, 1, 12, 0, 0, 500000));
+  CHECK(ParseFixUtcTimestamp("20240229") == 0);
+  CHECK(ParseFixUtcTimestamp("20240229 23:59:58") == 0);
+
+  auto report = Replace(
+      "8=FIX.4.2|9=0|35=8|34=42|49=T|56=S|11=7|17=E1|20=0|150=1|"
+      "32=10.5|31=99.125|60=20240229-23:59:58.123|58=part|10=000|");
+  FixReport r;
+  CHECK(ParseFixReport(report.data(), report.size(), &r));
+  CHECK(r.msg_type == '8');
+  CHECK(r.msg_seq_num == "42");
+  CHECK(ParseFixInt(r.cl_ord_id) == 7);
+  CHECK(r.exec_id == "E1");
+  CHECK(r.exec_type == '1');
+  CHECK(r.last_shares.ToDouble() == 10.5);
+  CHECK(r.last_px.ToDouble() == 99.125);
+  CHECK(r.transact_time == tm - 456);
+  CHECK(r.text == "part");
+
+  auto heartbeat = Replace("8=FIX.4.2|9=0|35=0|34=43|10=000|");
+  CHECK(!ParseFixReport(heartbeat.data(), heartbeat.size(), &r));
+  return 0;
+}
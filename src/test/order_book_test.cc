@@ -0,0 +1,151 @@
+// Cancel keeps the original order indexed under its own id, the cancel
+// request gets an id of its own. A cancel held by the message rate pacer and
+// rejected after its original was canceled leaves outstanding qty alone.
+
+#include <chrono>
+#include <thread>
+
+#include "opentrade/algo.h"
+#include "opentrade/exchange_connectivity.h"
+#include "opentrade/order.h"
+#include "opentrade/position.h"
+#include "test.h"
+
+using namespace opentrade;
+
+class TestAdapter : public ExchangeConnectivityAdapter {
+ public:
+  TestAdapter() {
+    set_name("test");
+    connected_ = 1;
+  }
+  void Start() noexcept override {}
+  std::string Place(const Order& ord) noexcept override {
+    placed = ord.id;
+    return {};
+  }
+  std::string Cancel(const Order& ord) noexcept override {
+    canceled = ord.id;
+    return {};
+  }
+
+  std::atomic<Order::IdType> placed = 0;
+  std::atomic<Order::IdType> canceled = 0;
+};
+
+class TestAlgo : public Algo {
+ public:
+  std::string OnStart(const ParamMap& params) noexcept override { return {}; }
+  void OnStop() noexcept override {}
+  void OnMarketTrade(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {}
+  void OnMarketQuote(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {}
+  void OnConfirmation(const Confirmation& cm) noexcept override {
+    if (cm.exec_type == kRiskRejected) risk_rejected++;
+  }
+  const ParamDefs& GetParamDefs() noexcept override { return defs; }
+
+  ParamDefs defs;
+  std::atomic<int> risk_rejected = 0;
+};
+
+template <typename Func>
+static bool WaitFor(Func func) {
+  for (auto i = 0; i < 1000 && !func(); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return func();
+}
+
+int main() {
+  Exchange exchange;
+  exchange.id = 1;
+  exchange.name = "TEST";
+  Security sec;
+  sec.id = 1;
+  sec.symbol = "TEST";
+  sec.exchange = &exchange;
+  sec.close_price = 10;
+  TestAdapter adapter;
+  BrokerAccount broker;
+  broker.id = 1;
+  broker.name = "broker";
+  broker.adapter_name = "test";
+  broker.adapter = &adapter;
+  SubAccount sub;
+  sub.id = 1;
+  sub.name = "sub";
+  sub.broker_accounts =
+      new SubAccount::BrokerAccountMap{{exchange.id, &broker}};
+  User user;
+  user.id = 1;
+  user.name = "user";
+  user.sub_accounts = new User::SubAccountMap{{sub.id, &sub}};
+
+  auto& book = GlobalOrderBook::Instance();
+  auto& ecm = ExchangeConnectivityManager::Instance();
+  auto ord = book.NewOrder();
+  ord->sec = &sec;
+  ord->sub_account = &sub;
+  ord->user = &user;
+  ord->qty = 100;
+  ord->price = 10;
+  CHECK(ecm.Place(ord));
+  auto id = ord->id;
+  CHECK(id > 0);
+  CHECK(book.Get(id) == ord);
+  CHECK(WaitFor([&]() { return adapter.placed == id; }));
+  adapter.HandleNew(id, "1");
+  CHECK(ord->status == kNew);
+
+  CHECK(ecm.Cancel(*ord));
+  CHECK(book.Get(id) == ord);
+  CHECK(WaitFor([&]() { return adapter.canceled != 0; }));
+  auto cancel_id = adapter.canceled.load();
+  CHECK(cancel_id != id);
+  auto cancel_ord = book.Get(cancel_id);
+  CHECK(cancel_ord && cancel_ord != ord);
+  CHECK(cancel_ord->orig_id == id);
+
+  adapter.HandleCanceled(cancel_id, 0, "");
+  CHECK(book.Get(id) == ord);
+  CHECK(ord->status == kCanceled);
+  CHECK(!ord->IsLive());
+  CHECK(book.GetLiveOrders(kLiveBySubAccount, sub.id).empty());
+
+  // one message per 100ms, the cancel below is held by the pacer
+  AlgoManager::Instance().Run(1);
+  TestAlgo algo;
+  Instrument inst(&algo, sec, 0);
+  sub.limits.msg_rate = 10;
+  sub.limits.msg_burst = 1;
+  sub.limits.msg_queue_ms = 1000;
+  ord = book.NewOrder();
+  ord->sec = &sec;
+  ord->sub_account = &sub;
+  ord->user = &user;
+  ord->inst = &inst;
+  ord->qty = 100;
+  ord->price = 10;
+  CHECK(ecm.Place(ord));
+  id = ord->id;
+  CHECK(WaitFor([&]() { return adapter.placed == id; }));
+  adapter.HandleNew(id, "2");
+  adapter.canceled = 0;
+  CHECK(ecm.Cancel(*ord));
+  cancel_ord = book.Get(id + 1);
+  CHECK(cancel_ord && cancel_ord->orig_id == id);
+  adapter.HandleCanceled(id, 0, "");
+  CHECK(ord->status == kCanceled);
+  auto& pos = PositionManager::Instance().Get(sub, sec);
+  auto pos_outstanding = pos.total_outstanding_buy_qty;
+  auto inst_outstanding = inst.outstanding_buy_qty();
+  CHECK(WaitFor([&]() { return cancel_ord->status == kRiskRejected; }));
+  CHECK(adapter.canceled == 0);
+  CHECK(pos.total_outstanding_buy_qty == pos_outstanding);
+  CHECK(pos.total_outstanding_buy_qty == 0);
+  CHECK(inst.outstanding_buy_qty() == inst_outstanding);
+  CHECK(algo.risk_rejected == 0);
+  ExchangeConnectivityManager::Instance().Stop();
+  return 0;
+}
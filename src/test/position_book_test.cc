@@ -0,0 +1,88 @@
+// The PositionBook kernels agree with a plain loop on a randomized book.
+// Built once per instruction set (scalar, AVX2, AVX-512), variants the cpu
+// does not support are skipped.
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "opentrade/position_book.h"
+#include "test.h"
+
+using namespace opentrade;
+
+struct Row {
+  const Security* sec;
+  double qty;
+  double avg_price;
+  double price;
+};
+
+static bool Near(double a, double b) {
+  return std::abs(a - b) <= 1e-9 * std::max(1., std::abs(b));
+}
+
+static void Check(const PositionBook& book, const std::vector<Row>& rows,
+                  double shock) {
+  PositionBook::Totals expected;
+  std::map<int, double> sectors;
+  for (auto& r : rows) {
+    auto m = r.sec->multiplier * r.sec->rate;
+    auto px = r.price * (1 + shock);
+    auto v = r.qty * m * px;
+    expected.unrealized_pnl += r.qty * m * (px - r.avg_price);
+    expected.gross_exposure += std::abs(v);
+    expected.net_exposure += v;
+    sectors[r.sec->sector] += v;
+  }
+  auto totals = book.Compute(shock);
+  CHECK(Near(totals.unrealized_pnl, expected.unrealized_pnl));
+  CHECK(Near(totals.gross_exposure, expected.gross_exposure));
+  CHECK(Near(totals.net_exposure, expected.net_exposure));
+  auto got = book.GetSectorExposure(shock);
+  CHECK(got.size() == sectors.size());
+  for (auto& pair : sectors) CHECK(Near(got[pair.first], pair.second));
+}
+
+int main() {
+#if defined(__AVX512F__)
+  if (!__builtin_cpu_supports("avx512f")) return 0;
+#elif defined(__AVX2__)
+  if (!__builtin_cpu_supports("avx2")) return 0;
+#endif
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> qty(-1000, 1000);
+  std::uniform_real_distribution<double> px(1, 500);
+  std::uniform_int_distribution<int> pick(0, 15);
+
+  std::vector<Security> secs(16);
+  for (auto i = 0u; i < secs.size(); ++i) {
+    secs[i].multiplier = 1 + i % 3;
+    secs[i].rate = 0.5 + i % 4 * 0.25;
+    secs[i].sector = 10 + i % 5 * 5;
+  }
+
+  // odd sizes exercise the padding
+  for (auto n : {0, 1, 7, 8, 9, 1001}) {
+    PositionBook a, b;
+    std::vector<Row> rows;
+    for (auto i = 0; i < n; ++i) {
+      Row r{&secs[pick(rng)], qty(rng), px(rng), px(rng)};
+      auto& book = i % 2 ? b : a;
+      auto j = book.Add(*r.sec, 0, 0, r.price);
+      // rows are updated in place after a fill
+      book.Set(j, r.qty, r.avg_price, 0);
+      rows.push_back(r);
+    }
+    // rows of a first, then of b
+    std::vector<Row> sorted;
+    for (auto i = 0; i < n; i += 2) sorted.push_back(rows[i]);
+    for (auto i = 1; i < n; i += 2) sorted.push_back(rows[i]);
+    a.Append(b);
+    CHECK(a.size() == static_cast<size_t>(n));
+    for (auto shock : {0., -0.1, 0.25}) Check(a, sorted, shock);
+  }
+  return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+// the tests are plain executables run by ctest, failing on the first check
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                 \
+      exit(1);                                                        \
+    }                                                                 \
+  } while (0)
+
+#endif  // TEST_TEST_H_